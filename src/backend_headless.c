@@ -0,0 +1,62 @@
+#include <stdlib.h>
+#include <string.h>
+#include "log.h"
+#include "gpu.h"
+#include "keyboard.h"
+
+// Video, frames are rendered in memory and never shown
+typedef struct headless_screen {
+	uint16_t width;
+	uint8_t *pixels;
+} headless_screen;
+
+static void* headless_init(uint16_t width, uint16_t height) {
+	headless_screen *screen = malloc(sizeof(headless_screen));
+	if (screen == NULL)
+		ERROR("Unable to allocate memory for headless screen.\n");
+
+	// Fill with white
+	screen->width = width;
+	screen->pixels = malloc(width * height);
+	if (screen->pixels == NULL)
+		ERROR("Unable to allocate memory for headless screen.\n");
+	memset(screen->pixels, 0xFF, width * height);
+	return screen;
+}
+
+static void headless_end(void* data) {
+	headless_screen *screen = data;
+	free(screen->pixels);
+	free(screen);
+}
+
+static uint8_t* headless_lock(void* data, uint16_t* pitch) {
+	headless_screen *screen = data;
+	*pitch = screen->width;
+	return screen->pixels;
+}
+
+static void headless_unlock(void* data) {
+}
+
+static void headless_flip(void* data) {
+}
+
+static void headless_pump(void* data) {
+}
+
+const gpu_backend gpu_backend_headless = {
+	headless_init, headless_end, headless_lock, headless_unlock, headless_flip, headless_pump
+};
+
+// Inputs, no key is ever pressed
+static void headless_poll(keyboard *kb, interrupts *ir) {
+}
+
+// Nothing could wake up a stopped CPU, resume right away
+static void headless_wait(keyboard *kb, interrupts *ir) {
+}
+
+const keyboard_backend keyboard_backend_headless = {
+	headless_poll, headless_wait
+};
@@ -0,0 +1,119 @@
+#include <SDL/SDL.h>
+#include "log.h"
+#include "gpu.h"
+#include "keyboard.h"
+#include "presenter.h"
+
+// Video
+static void* sdl_init(uint16_t width, uint16_t height) {
+	if (SDL_Init(SDL_INIT_VIDEO) == -1)
+		ERROR("Unable to load SDL: %s\n", SDL_GetError());
+
+	SDL_Surface *surface = SDL_SetVideoMode(width, height, 8, SDL_HWSURFACE);
+	if (surface == NULL)
+		ERROR("Unable to get the SDL surface: %s\n", SDL_GetError());
+
+	// Fill with white
+	if (SDL_FillRect(surface, NULL, SDL_MapRGB(surface->format, 0xFF, 0xFF, 0xFF)) == -1)
+		ERROR("Unable to fill surface with white: %s\n", SDL_GetError());
+
+	if (SDL_Flip(surface) == -1)
+		ERROR("Unable to flip surface at init: %s\n", SDL_GetError());
+
+	return surface;
+}
+
+static void sdl_end(void* data) {
+	SDL_Quit();
+}
+
+static uint8_t* sdl_lock(void* data, uint16_t* pitch) {
+	SDL_Surface *surface = data;
+	SDL_LockSurface(surface);
+	*pitch = surface->pitch;
+	return surface->pixels;
+}
+
+static void sdl_unlock(void* data) {
+	SDL_UnlockSurface(data);
+}
+
+static void sdl_flip(void* data) {
+	SDL_Flip(data);
+}
+
+// Events can only be pumped from the thread which set the video mode
+static void sdl_pump(void* data) {
+	SDL_PumpEvents();
+}
+
+const gpu_backend gpu_backend_sdl = {
+	sdl_init, sdl_end, sdl_lock, sdl_unlock, sdl_flip, sdl_pump
+};
+
+// Inputs, events are only available once the video is initiated. They are
+// pumped by the presenter thread and taken from the event queue here.
+static keyboard_key sdl_to_key(SDLKey key) {
+	switch(key) {
+	case SDLK_a:
+		return KEY_A;
+	case SDLK_b:
+		return KEY_B;
+	case SDLK_l:
+		return KEY_SELECT;
+	case SDLK_s:
+		return KEY_START;
+	case SDLK_RIGHT:
+		return KEY_RIGHT;
+	case SDLK_LEFT:
+		return KEY_LEFT;
+	case SDLK_UP:
+		return KEY_UP;
+	case SDLK_DOWN:
+		return KEY_DOWN;
+	default:
+		return KEY_UNKNOWN;
+	}
+}
+
+// Report a key event, return 0 for other events
+static uint8_t sdl_handle_event(keyboard *kb, interrupts *ir, SDL_Event *event) {
+	keyboard_key key = KEY_UNKNOWN;
+
+	switch(event->type)
+	{
+	case SDL_KEYDOWN:
+		key = sdl_to_key(event->key.keysym.sym);
+		if (key != KEY_UNKNOWN)
+			keyboard_pressed(kb, key, ir);
+		return 1;
+	case SDL_KEYUP:
+		key = sdl_to_key(event->key.keysym.sym);
+		if (key != KEY_UNKNOWN)
+			keyboard_released(kb, key, ir);
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+static void sdl_poll(keyboard *kb, interrupts *ir) {
+	SDL_Event event;
+	while (SDL_PeepEvents(&event, 1, SDL_GETEVENT, SDL_ALLEVENTS) > 0)
+		sdl_handle_event(kb, ir, &event);
+}
+
+static void sdl_wait(keyboard *kb, interrupts *ir) {
+	SDL_Event event;
+	while (1) {
+		while (SDL_PeepEvents(&event, 1, SDL_GETEVENT, SDL_ALLEVENTS) > 0)
+			if (sdl_handle_event(kb, ir, &event))
+				return;
+
+		SDL_Delay(PRESENTER_IDLE_MS);
+	}
+}
+
+const keyboard_backend keyboard_backend_sdl = {
+	sdl_poll, sdl_wait
+};
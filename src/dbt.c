@@ -0,0 +1,348 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dbt.h"
+#include "interrupts.h"
+#include "scheduler.h"
+#include "log.h"
+
+dbt* dbt_init(memory* mem) {
+	dbt* tr = calloc(1, sizeof(dbt));
+	if (tr == NULL)
+		ERROR("Unable to allocate memory for binary translation.\n");
+
+	tr->bios = calloc(0x100, sizeof(dbt_block*));
+	if (tr->bios == NULL)
+		ERROR("Unable to allocate memory for BIOS translated blocks.\n");
+
+	tr->ram = calloc(DBT_RAM_SIZE, sizeof(dbt_block*));
+	if (tr->ram == NULL)
+		ERROR("Unable to allocate memory for RAM translated blocks.\n");
+
+	tr->cur = NULL;
+	tr->mem = mem;
+	memory_set_dbt(mem, tr);
+	return tr;
+}
+
+static void dbt_free_blocks(dbt_block** blocks, uint32_t count) {
+	uint32_t i = 0;
+	for (i = 0; i < count; i++)
+		free(blocks[i]);
+	free(blocks);
+}
+
+void dbt_end(dbt* tr) {
+	uint32_t i = 0;
+
+	dbt_free_blocks(tr->bios, 0x100);
+	dbt_free_blocks(tr->ram, DBT_RAM_SIZE);
+	for (i = 0; i < DBT_MAX_ROM_BANKS; i++)
+		if (tr->rom[i] != NULL)
+			dbt_free_blocks(tr->rom[i], DBT_ROM_BANK_SIZE);
+
+	free(tr);
+}
+
+// Slot of the block starting at addr, NULL if code at addr is never translated
+static dbt_block** dbt_slot(dbt* tr, memory* mem, uint16_t addr) {
+	// BIOS
+	if (addr < 0x100 && mem->in_bios)
+		return &(tr->bios[addr]);
+
+	// Cartridge ROM, keyed by bank
+	if (addr < 0x8000) {
+		uint32_t offset = memory_rom_offset(mem, addr);
+		uint32_t bank = offset / DBT_ROM_BANK_SIZE;
+
+		if (bank >= DBT_MAX_ROM_BANKS)
+			ERROR("Translating code in unknown ROM bank %u\n", bank);
+
+		if (tr->rom[bank] == NULL) {
+			tr->rom[bank] = calloc(DBT_ROM_BANK_SIZE, sizeof(dbt_block*));
+			if (tr->rom[bank] == NULL)
+				ERROR("Unable to allocate memory for ROM bank %u translated blocks.\n", bank);
+		}
+
+		return &(tr->rom[bank][offset % DBT_ROM_BANK_SIZE]);
+	}
+
+	// Sprites, I/O & interrupt enable
+	if ((addr >= 0xFE00 && addr < 0xFF80) || addr == 0xFFFF)
+		return NULL;
+
+	return &(tr->ram[addr - DBT_RAM_START]);
+}
+
+// End of the memory region containing addr, blocks never cross it
+static uint32_t dbt_region_end(memory* mem, uint16_t addr) {
+	if (addr < 0x100 && mem->in_bios)
+		return 0x100;
+	if (addr < 0x4000)
+		return 0x4000;
+	if (addr < 0x8000)
+		return 0x8000;
+	if (addr < 0xFE00)
+		return 0xFE00;
+	return 0xFFFF;
+}
+
+// Working RAM page seen through the shadow region (and the other way around)
+static int16_t dbt_shadow_page(uint8_t page) {
+	if (page >= 0xC0 && page < 0xDE)
+		return page + 0x20;
+	if (page >= 0xE0 && page < 0xFE)
+		return page - 0x20;
+	return -1;
+}
+
+// Count a RAM block in or out of a page, the first block in and the last one
+// out change the page mapping
+static void dbt_count_page(dbt* tr, uint8_t page, int8_t delta) {
+	tr->code_pages[page] += delta;
+	if (tr->code_pages[page] == (delta > 0 ? 1 : 0))
+		memory_map_page(tr->mem, page);
+}
+
+// Count a RAM block in or out of the pages it covers and their shadows
+static void dbt_watch_block(dbt* tr, dbt_block* blk, int8_t delta) {
+	uint32_t page = 0;
+	for (page = blk->start >> 8; page <= (blk->start + blk->length - 1) >> 8; page++) {
+		int16_t shadow = dbt_shadow_page(page);
+		dbt_count_page(tr, page, delta);
+		if (shadow >= 0)
+			dbt_count_page(tr, shadow, delta);
+	}
+}
+
+// Mark the bytes of a RAM block in the code bitmap
+static void dbt_mark_block(dbt* tr, dbt_block* blk) {
+	uint32_t addr = 0;
+	for (addr = blk->start; addr < blk->start + blk->length; addr++) {
+		uint16_t i = dbt_code_index(addr);
+		tr->code_bytes[i >> 3] |= 1 << (i & 0x7);
+	}
+}
+
+static dbt_block* dbt_translate(dbt* tr, memory* mem, uint16_t start) {
+	dbt_instr instrs[DBT_MAX_BLOCK_INSTRS];
+	uint32_t end = dbt_region_end(mem, start);
+	uint32_t addr = start;
+	uint8_t count = 0;
+	uint8_t stores = 0;
+
+	// Decode up to the first control flow instruction
+	while (count < DBT_MAX_BLOCK_INSTRS) {
+		opcode_info info;
+		opcodes_decode(mem, addr, &info);
+
+		if (addr + info.length > end)
+			break;
+
+		instrs[count].handler = info.handler;
+		instrs[count].operand = info.operand;
+		instrs[count].length = info.length;
+		instrs[count].cycles = info.cycles;
+		instrs[count].last = 0;
+		stores += info.store;
+		count++;
+		addr += info.length;
+
+		if (info.end_block)
+			break;
+	}
+
+	if (count == 0)
+		return NULL;
+
+	instrs[count - 1].last = 1;
+
+	dbt_block* blk = malloc(sizeof(dbt_block) + count * sizeof(dbt_instr));
+	if (blk == NULL)
+		ERROR("Unable to allocate memory for translated block.\n");
+
+	blk->start = start;
+	blk->length = addr - start;
+	blk->count = count;
+	blk->stores = stores;
+	blk->link = NULL;
+	memcpy(blk->instrs, instrs, count * sizeof(dbt_instr));
+
+	// Watch writes on RAM code, they must leave the memory fast path
+	if (start >= DBT_RAM_START) {
+		dbt_watch_block(tr, blk, 1);
+		dbt_mark_block(tr, blk);
+	}
+
+	tr->compiled++;
+	DEBUG_DBT("Translated block %X-%X (%d instructions)\n", start, addr, count);
+	return blk;
+}
+
+// Drop the blocks overlapping from-to, their pages are watched as long as
+// other blocks remain
+static void dbt_invalidate_ram(dbt* tr, uint32_t from, uint32_t to) {
+	uint32_t addr = DBT_RAM_START;
+
+	// Blocks starting before from may overlap it
+	if (from > DBT_RAM_START + DBT_MAX_BLOCK_BYTES)
+		addr = from - DBT_MAX_BLOCK_BYTES;
+
+	for (; addr < to; addr++) {
+		dbt_block** slot = &(tr->ram[addr - DBT_RAM_START]);
+		if (*slot != NULL && (*slot)->start + (*slot)->length > from) {
+			DEBUG_DBT("Invalidate block %X\n", addr);
+			tr->invalidated++;
+
+			// The running block may be gone
+			tr->cur = NULL;
+			tr->epoch++;
+			dbt_watch_block(tr, *slot, -1);
+			free(*slot);
+			*slot = NULL;
+		}
+	}
+}
+
+void dbt_invalidate_range(dbt* tr, uint16_t from, uint32_t to) {
+	uint32_t page = 0;
+
+	if (from < DBT_RAM_START)
+		ERROR("Invalidating translated ROM at %X\n", from);
+
+	for (page = from >> 8; page <= (to - 1) >> 8; page++) {
+		uint32_t page_from = (page << 8) > from ? (page << 8) : from;
+		uint32_t page_to = ((page + 1) << 8) < to ? ((page + 1) << 8) : to;
+		int16_t shadow = dbt_shadow_page(page);
+
+		dbt_invalidate_ram(tr, page_from, page_to);
+		if (shadow >= 0)
+			dbt_invalidate_ram(tr, page_from - (page << 8) + (shadow << 8), page_to - (page << 8) + (shadow << 8));
+	}
+}
+
+// Interpret the instruction at PC, leaving the current block
+static int8_t dbt_interpret(dbt* tr, state* st, memory* mem) {
+	tr->cur = NULL;
+	tr->interpreted++;
+
+	z80_opcode opcode = memory_read_byte(mem, st->reg.PC);
+	st->reg.PC++;
+
+	int8_t clk = opcodes_execute(opcode, st, mem);
+	if (clk > 0)
+		mem->sch->now += clk;
+	return clk;
+}
+
+// Execute the instructions at PC, chaining the translated blocks up to the
+// next event. The clock is advanced by each instruction, the total cycles are
+// returned.
+int32_t dbt_execute(dbt* tr, state* st, memory* mem) {
+	scheduler* sch = mem->sch;
+	dbt_instr* instr = tr->cur;
+	dbt_block* blk = NULL; // Block running, once looked up
+	uint64_t epoch = tr->epoch;
+	uint8_t irq_master = st->irq_master;
+	int32_t total = 0;
+	int32_t loop_start = 0;
+	uint8_t regs[sizeof(st->reg)]; // Registers on entering a block without stores
+
+	// OAM DMA blocks the bus, code must be fetched as it is seen meanwhile
+	// and never translated
+	if (mem->dma_active)
+		return dbt_interpret(tr, st, mem);
+
+	// Only events, I/O accesses and the instructions ending blocks change the
+	// interrupts state, the caller serves them
+	interrupts* ir = mem->ir;
+	mem->io_access = 0;
+	do {
+		// Jumped out of the current block, follow its link or look up the
+		// block at PC. The previous block may be gone once the epoch changed.
+		if (instr == NULL || st->reg.PC != tr->next_pc) {
+			if (blk != NULL && tr->epoch != epoch)
+				blk = NULL;
+
+			tr->lookups++;
+			if (blk != NULL && blk->link != NULL && blk->link_pc == st->reg.PC && blk->link_epoch == epoch) {
+				tr->hits++;
+				blk = blk->link;
+			} else {
+				dbt_block** slot = dbt_slot(tr, mem, st->reg.PC);
+				if (slot != NULL && *slot != NULL)
+					tr->hits++;
+				else if (slot != NULL)
+					*slot = dbt_translate(tr, mem, st->reg.PC);
+
+				// Untranslatable code, fall back to the interpreter
+				if (slot == NULL || *slot == NULL) {
+					int8_t clk = dbt_interpret(tr, st, mem);
+					return clk < 0 ? clk : total + clk;
+				}
+
+				if (blk != NULL) {
+					blk->link = *slot;
+					blk->link_pc = st->reg.PC;
+					blk->link_epoch = epoch;
+				}
+				blk = *slot;
+			}
+
+			epoch = tr->epoch;
+			instr = blk->instrs;
+			if (blk->stores == 0) {
+				memcpy(regs, &st->reg, sizeof(regs));
+				loop_start = total;
+			}
+		}
+
+		// Set cursor before running, the instruction may invalidate its own
+		// block or remap memory, the cursor is then cleared and nothing is
+		// read from the block afterwards
+		int8_t cycles = instr->cycles;
+		tr->cur = instr->last ? NULL : instr + 1;
+		tr->next_pc = st->reg.PC + instr->length;
+		st->reg.PC = tr->next_pc;
+
+		int8_t extra = opcodes_run(instr->handler, st, mem, instr->operand);
+		if (extra < 0)
+			return extra;
+
+		sch->now += cycles + extra;
+		total += cycles + extra;
+		instr = tr->cur;
+
+		if (instr == NULL && (st->irq_master != irq_master || st->halt_mode || st->halt_bug || st->stop_mode))
+			break;
+
+		// A block without stores nor I/O accesses jumping back to itself with
+		// the same registers spins until an event: skip the whole iterations
+		// ending before the deadline, the last one runs to cross it on the same
+		// instruction. The block may be gone once the epoch changed.
+		if (instr == NULL && blk != NULL && tr->epoch == epoch && blk->stores == 0 &&
+		    st->reg.PC == blk->start && !mem->io_access && sch->now < sch->next &&
+		    memcmp(regs, &st->reg, sizeof(regs)) == 0) {
+			int32_t period = total - loop_start;
+			uint64_t skip = (sch->next - sch->now) / period * period;
+			sch->now += skip;
+			total += skip;
+			tr->idle += skip;
+		}
+	} while (sch->now < sch->next &&
+	         !(mem->io_access && (mem->dma_active || (st->irq_master && interrupts_pending(ir)))));
+
+	return total;
+}
+
+void dbt_print_stats(dbt* tr) {
+	double hit_rate = tr->lookups ? 100.0 * tr->hits / tr->lookups : 0;
+
+	printf("Block look ups: %" PRIu64 " (%.2f%% hits)\n", tr->lookups, hit_rate);
+	printf("Blocks compiled: %" PRIu64 "\n", tr->compiled);
+	printf("Blocks invalidated: %" PRIu64 "\n", tr->invalidated);
+	printf("Interpreted instructions: %" PRIu64 "\n", tr->interpreted);
+	printf("Idle cycles skipped: %" PRIu64 "\n", tr->idle);
+}
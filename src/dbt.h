@@ -0,0 +1,101 @@
+#ifndef __DBT_H__
+#define __DBT_H__
+
+#include <stdint.h>
+
+#include "opcodes.h"
+
+// Dynamic binary translation: straight-line basic blocks are decoded once,
+// cached per bank and address and then run as threaded code. Each entry holds
+// its handler, its pre-fetched immediate operand and its base cycle cost.
+
+#define DBT_MAX_BLOCK_INSTRS 32
+#define DBT_MAX_BLOCK_BYTES  (DBT_MAX_BLOCK_INSTRS * 3)
+#define DBT_MAX_ROM_BANKS    512
+#define DBT_ROM_BANK_SIZE    0x4000
+#define DBT_RAM_START        0x8000
+#define DBT_RAM_SIZE         0x8000
+
+typedef struct dbt_instr {
+	opcode_handler handler;
+	uint16_t operand;
+	uint8_t length;
+	uint8_t cycles;
+	uint8_t last;
+} dbt_instr;
+
+typedef struct dbt_block {
+	uint16_t start;
+	uint16_t length; // Bytes covered by the block
+	uint8_t count;
+	uint8_t stores;  // Instructions writing memory
+
+	// Block run after this one last time, valid while the epoch is unchanged
+	struct dbt_block* link;
+	uint16_t link_pc;
+	uint64_t link_epoch;
+
+	dbt_instr instrs[];
+} dbt_block;
+
+typedef struct dbt {
+	memory* mem;
+
+	// Translated blocks, indexed by address
+	dbt_block** bios;
+	dbt_block** rom[DBT_MAX_ROM_BANKS];
+	dbt_block** ram;
+
+	// Translated blocks covering each RAM page (256 bytes), shadows included
+	uint16_t code_pages[0x100];
+
+	// RAM bytes translated since the last store to them, one bit each
+	uint8_t code_bytes[DBT_RAM_SIZE / 8];
+
+	// Next instruction to run in the current block
+	dbt_instr* cur;
+	uint16_t next_pc;
+
+	// Bumped when memory is remapped or blocks are dropped, block links are
+	// then stale
+	uint64_t epoch;
+
+	// Statistics
+	uint64_t lookups;     // Block look ups (jumps out of the current block)
+	uint64_t hits;        // Look ups served by an already translated block
+	uint64_t compiled;    // Blocks translated
+	uint64_t invalidated; // Blocks dropped by writes or bank switches
+	uint64_t interpreted; // Instructions run by the interpreter
+	uint64_t idle;        // Cycles skipped in idle loops
+} dbt;
+
+dbt* dbt_init(memory* mem);
+void dbt_end(dbt* tr);
+int32_t dbt_execute(dbt* tr, state* st, memory* mem);
+void dbt_invalidate_range(dbt* tr, uint16_t from, uint32_t to);
+void dbt_print_stats(dbt* tr);
+
+// Memory mapping changed, current block must be looked up again
+static inline void dbt_remap(dbt* tr) {
+	tr->cur = NULL;
+	tr->epoch++;
+}
+
+// Index of a RAM byte in the code bitmap, shadow region folded on working RAM
+static inline uint16_t dbt_code_index(uint16_t addr) {
+	if (addr >= 0xE000 && addr < 0xFE00)
+		addr -= 0x2000;
+	return addr - DBT_RAM_START;
+}
+
+// Drop the translated blocks overwritten by a store, none covers the byte
+// afterwards
+static inline void dbt_notify_write(dbt* tr, uint16_t addr) {
+	uint16_t i = dbt_code_index(addr);
+	if (tr->code_bytes[i >> 3] & (1 << (i & 0x7))) {
+		dbt_invalidate_range(tr, addr, addr + 1);
+		tr->code_bytes[i >> 3] &= ~(1 << (i & 0x7));
+	}
+}
+
+#endif     // __DBT_H__
@@ -7,65 +7,129 @@
 #include "log.h"
 #include "opcodes.h"
 #include "gpu.h"
+#include "presenter.h"
+#include "recorder.h"
 #include "keyboard.h"
 #include "interrupts.h"
 #include "timer.h"
+#include "dbt.h"
+#include "scheduler.h"
+#include "pacer.h"
 
 int activate_debug = 0;
 
+// Cleared on SIGINT to leave the main loop
+static volatile sig_atomic_t running = 1;
+
 // Execute a gameboy rom through the emulator
-void emulator_execute_rom(GB *rom)
+void emulator_execute_rom(GB *rom, emulator_options *opts)
 {
 	// Initiate memory
 	memory *mem = memory_init(rom);
 
-	// Initiate graphics
-	gpu* gp = gpu_init(mem);
+	// Initiate events scheduling
+	scheduler *sch = scheduler_init(mem);
 
-	// Initiate inputs
-	keyboard *kb = keyboard_init(mem);
-	timer* t = timer_init(mem);
+	// Initiate frame pacing
+	pacer *pc = pacer_init(mem, opts->unthrottled ? 0 : opts->speed);
+
+	// Initiate binary translation, the interpreter is used without it
+	dbt *tr = NULL;
+	if (!opts->interpreter)
+		tr = dbt_init(mem);
 
 	// Initiate interrupts
 	interrupts *ir = interrupts_init(mem);
 
+	// Select the video & inputs backend
+	const gpu_backend *video = &gpu_backend_headless;
+	const keyboard_backend *input = &keyboard_backend_headless;
+#ifndef NO_SDL
+	if (!opts->headless) {
+		video = &gpu_backend_sdl;
+		input = &keyboard_backend_sdl;
+	}
+#endif
+
+	// Initiate graphics, frames are shown by the presenter thread
+	presenter *pr = presenter_init(video, opts->scale, opts->filter);
+	gpu* gp = gpu_init(mem, pr);
+	gpu_set_frameskip(gp, opts->frameskip, opts->autoskip ? pc : NULL);
+
+	// Initiate recording, frames are written by the recorder thread
+	recorder *rc = NULL;
+	if (opts->record != NULL || opts->shots != NULL) {
+		uint32_t shots[RECORDER_MAX_SHOTS];
+		uint8_t shot_count = 0;
+		const char *s = opts->shots;
+		while (s != NULL && *s != '\0') {
+			if (shot_count == RECORDER_MAX_SHOTS)
+				ERROR("Too many screenshots requested.\n");
+			shots[shot_count++] = strtoul(s, (char**)&s, 10);
+			if (*s == ',')
+				s++;
+			else if (*s != '\0')
+				ERROR("Invalid screenshot frame list %s.\n", opts->shots);
+		}
+
+		rc = recorder_init(opts->record, opts->shot_prefix, shots, shot_count);
+		gpu_set_recorder(gp, rc);
+	}
+
+	// Initiate inputs
+	keyboard *kb = keyboard_init(mem, input);
+	timer* t = timer_init(mem);
+
 	// Initiate machine state
 	state st;
 	memset(&st, 0, sizeof(st));
-	st.clk = 0;
 	st.irq_master = 1;
 
 	// Main loop
-	uint16_t last_pause = 0;
 	uint16_t bp = 0x100;
 	uint16_t bp_seen = 0;
 	uint16_t bp_step = 0;
 
-	while (1) {
-		// Fetch OpCode
-		z80_opcode opcode = memory_read_byte(mem, st.reg.PC);
-		st.reg.PC++;
-
-		// Decode/Execute opcode
-		int8_t clk = opcodes_execute(opcode, &st, mem);
-		if (clk < 0)
-			ERROR("Unknown operation!\n");
-
-		st.clk += clk;
-		last_pause += clk;
-
-		// Execute other architecture component if needed
-
-		// Handle stop mode
-		if (st.stop_mode) {
-			keyboard_wait_key(kb, ir);
-			st.stop_mode = 0;
+	while (running) {
+		if (st.halt_mode) {
+			// Nothing runs until an event raises an interrupt, skip to the
+			// next one
+			if (sch->next > sch->now)
+				sch->now = sch->next;
+		} else {
+			int32_t clk = 0;
+			if (tr != NULL && !st.halt_bug) {
+				// Execute translated code up to the next event, it advances
+				// the clock itself
+				clk = dbt_execute(tr, &st, mem);
+			} else {
+				// Fetch OpCode, the one after a bugged HALT is read twice
+				z80_opcode opcode = memory_read_byte(mem, st.reg.PC);
+				if (st.halt_bug)
+					st.halt_bug = 0;
+				else
+					st.reg.PC++;
+
+				// Decode/Execute opcode
+				clk = opcodes_execute(opcode, &st, mem);
+				if (clk > 0)
+					sch->now += clk;
+			}
+
+			if (clk < 0)
+				ERROR("Unknown operation!\n");
+
+			// Handle stop mode
+			if (st.stop_mode) {
+				keyboard_wait_key(kb, ir);
+				st.stop_mode = 0;
+			}
 		}
 
-		keyboard_process(kb, ir, clk);
-		gpu_process(gp, ir, clk);
+		// Other architecture components only run when one of their events
+		// is due
+		scheduler_sync(sch);
 		interrupts_process(ir, &st, mem);
-		timer_process(t, ir, clk);
 
 		// Debug stuff
 		if (st.reg.PC == bp) {
@@ -75,44 +139,111 @@ void emulator_execute_rom(GB *rom)
 
 		if (bp_seen && bp_step)
 			getchar();
-
-		// Sleep each frame
-		if (last_pause >= 17556) {
-			usleep(10000);
-			last_pause = 0;
-		}
 	}
 
+	if (opts->stats && tr != NULL)
+		dbt_print_stats(tr);
+
 	// Clean stuff
 	keyboard_end(kb);
 	timer_end(t);
+	pacer_end(pc);
 	interrupts_end(ir);
+	if (tr != NULL)
+		dbt_end(tr);
 	memory_end(mem);
 	gpu_end(gp);
+	if (rc != NULL)
+		recorder_end(rc);
+	presenter_end(pr);
+	scheduler_end(sch);
 }
 
 void sig_handler(int signo)
 {
 	if (signo == SIGINT)
-		exit(0);
+		running = 0;
 }
 int main(int argc, char *argv[]) {
 
-	// Install signal handler to force death
+	// Install signal handler to stop the emulation
 	signal(SIGINT, sig_handler);
 
-	if (argc < 2) {
-		printf("Usage: %s gbc_file\n", argv[0]);
+	// Parse options
+	emulator_options opts;
+	memset(&opts, 0, sizeof(opts));
+	opts.speed = 1;
+	opts.scale = 1;
+	opts.filter = PRESENTER_NEAREST;
+	const char *filename = NULL;
+	int i = 0;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--interpreter") == 0)
+			opts.interpreter = 1;
+		else if (strcmp(argv[i], "--stats") == 0)
+			opts.stats = 1;
+		else if (strcmp(argv[i], "--headless") == 0)
+			opts.headless = 1;
+		else if (strcmp(argv[i], "--unthrottled") == 0)
+			opts.unthrottled = 1;
+		else if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc)
+			opts.speed = strtod(argv[++i], NULL);
+		else if (strcmp(argv[i], "--scale") == 0 && i + 1 < argc)
+			opts.scale = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--scale2x") == 0)
+			opts.filter = PRESENTER_SCALE2X;
+		else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+			opts.record = argv[++i];
+		else if (strcmp(argv[i], "--screenshots") == 0 && i + 1 < argc)
+			opts.shots = argv[++i];
+		else if (strcmp(argv[i], "--frameskip") == 0 && i + 1 < argc) {
+			if (strcmp(argv[++i], "auto") == 0)
+				opts.autoskip = 1;
+			else
+				opts.frameskip = atoi(argv[i]);
+		}
+		else
+			filename = argv[i];
+	}
+
+	if (filename == NULL) {
+		printf("Usage: %s [--interpreter] [--stats] [--headless] [--speed N | --unthrottled] [--scale N] [--scale2x] [--frameskip N | auto] [--record FILE] [--screenshots N,...] gbc_file\n", argv[0]);
+		printf("\t--interpreter : do not translate code, interpret each opcode\n");
+		printf("\t--stats : print binary translation statistics on exit\n");
+		printf("\t--headless : render in memory only, no window and no inputs\n");
+		printf("\t--speed N : run N times faster than the real hardware\n");
+		printf("\t--unthrottled : run as fast as possible\n");
+		printf("\t--scale N : show the screen N times larger (1-%d)\n", PRESENTER_MAX_SCALE);
+		printf("\t--scale2x : smooth the upscaled screen with Scale2x, the scale is made even\n");
+		printf("\t--frameskip N : draw only one frame out of N + 1\n");
+		printf("\t--frameskip auto : skip drawing frames while the host is too slow\n");
+		printf("\t--record FILE : record the frames to a Y4M video\n");
+		printf("\t--screenshots N,... : save these frames as gbc_file-N.png, without the rom extension\n");
 		return 0;
 	}
 
+	// Scale2x doubles the screen before the integer scaling
+	if (opts.scale < 1 || opts.scale > PRESENTER_MAX_SCALE)
+		ERROR("Scale must be between 1 and %d.\n", PRESENTER_MAX_SCALE);
+	if (opts.filter == PRESENTER_SCALE2X && opts.scale % 2 != 0)
+		opts.scale++;
+
+	// Screenshots are named after the rom, without its extension
+	char shot_prefix[4096];
+	snprintf(shot_prefix, sizeof(shot_prefix), "%s", filename);
+	char *ext = strrchr(shot_prefix, '.');
+	if (ext != NULL && strchr(ext, '/') == NULL)
+		*ext = '\0';
+	opts.shot_prefix = shot_prefix;
+
 	// Load & check GB
-	GB *rom = gbc_open(argv[1]);
+	GB *rom = gbc_open(filename);
 	gbc_read_header(rom);
 	gbc_check_header(rom);
 
 	// Launch emulator
-	emulator_execute_rom(rom);
+	emulator_execute_rom(rom, &opts);
 
 	// Clean stuff
 	gbc_close(rom);
@@ -12,17 +12,31 @@ typedef struct state {
 		uint8_t F; // Flags
 	} reg;
 
-	// Clock
-	uint16_t clk;
-
 	// Interrupts
 	uint8_t irq_master;
 
 	// Stop & Halt mode
 	uint8_t stop_mode;
 	uint8_t halt_mode;
+	uint8_t halt_bug; // PC is not incremented after the next opcode fetch
 } state;
 
+// Command line options
+typedef struct emulator_options {
+	uint8_t interpreter; // Disable binary translation
+	uint8_t stats;       // Print binary translation statistics on exit
+	uint8_t headless;    // No window nor inputs, implied without SDL
+	uint8_t unthrottled; // Run as fast as possible
+	double speed;        // Multiplier of the real hardware speed
+	uint8_t scale;       // Screen size multiplier of the native resolution
+	uint8_t filter;      // Upscaling presenter_filter
+	uint8_t frameskip;   // Frames not drawn between two drawn ones
+	uint8_t autoskip;    // Skip frames only while late on the host clock
+	const char *record;  // Y4M video of the frames, NULL when not recorded
+	const char *shots;   // Comma separated frames saved as screenshots
+	const char *shot_prefix; // Screenshots are <prefix>-<frame>.png
+} emulator_options;
+
 typedef enum {
 	FLAG_NONE = 0x0,
 	FLAG_CARRY = 0x10,
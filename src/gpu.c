@@ -1,30 +1,128 @@
-#include <SDL/SDL.h>
+#include <stdlib.h>
+#include <string.h>
 #include "log.h"
 #include "memory.h"
 #include "gpu.h"
+#include "gpu_simd.h"
+#include "presenter.h"
+#include "pacer.h"
+#include "recorder.h"
 #include "interrupts.h"
+#include "scheduler.h"
 
 #define GPU_SET_MODE(gp, mode) (gp)->reg.status = ((gp)->reg.status & 0xFC) | (mode)
 #define GPU_GET_MODE(gp) ((gp)->reg.status & 0x3)
 
-gpu* gpu_init(memory *mem) {
-	gpu* gp = malloc(sizeof(gpu));
-	if (gp == NULL)
-		ERROR("Unable to allocate memory for gpu.\n");
+// Update LY == LYC flag, raise the LCD interrupt when they become equal
+static void gpu_check_line(gpu *gp) {
+	if (gp->reg.cur_line == gp->reg.check_line) {
+		if ((gp->reg.status & (1 << 2)) == 0 && (gp->reg.status & (1 << 6)))
+			interrupts_raise(gp->ir, IRQ_LCD);
+		gp->reg.status |= (1 << 2);
+	} else {
+		gp->reg.status &= ~(1 << 2);
+	}
+}
 
-	if (SDL_Init(SDL_INIT_VIDEO) == -1)
-		ERROR("Unable to load SDL: %s\n", SDL_GetError());
+static uint8_t gpu_read(void* dev, uint16_t addr) {
+	gpu *gp = dev;
+
+	switch (addr) {
+	case 0xFF40:
+		DEBUG_MEMORY("Reading LCD control  = %X\n", gp->reg.control);
+		return gp->reg.control;
+	case 0xFF41:
+		DEBUG_MEMORY("Reading LCD status  = %X\n", gp->reg.status);
+		return gp->reg.status;
+	case 0xFF42:
+		DEBUG_MEMORY("Reading GPU scroll_y = %X\n", gp->reg.scroll_y);
+		return gp->reg.scroll_y;
+	case 0xFF43:
+		DEBUG_MEMORY("Reading GPU scroll_x = %X\n", gp->reg.scroll_x);
+		return gp->reg.scroll_x;
+	case 0xFF44:
+		DEBUG_MEMORY("Reading GPU scanline  = %X\n", gp->reg.cur_line);
+		return gp->reg.cur_line;
+	case 0xFF45:
+		DEBUG_MEMORY("Reading GPU check scanline  = %X\n", gp->reg.check_line);
+		return gp->reg.check_line;
+	case 0xFF47:
+		DEBUG_MEMORY("Reading GPU background palette = %X\n", gp->reg.bg_pal);
+		return gp->reg.bg_pal;
+	case 0xFF48:
+		DEBUG_MEMORY("Reading GPU sprite palette 0 = %X\n", gp->reg.sp_pal_0);
+		return gp->reg.sp_pal_0;
+	case 0xFF49:
+		DEBUG_MEMORY("Reading GPU sprite palette 1 = %X\n", gp->reg.sp_pal_1);
+		return gp->reg.sp_pal_1;
+	case 0xFF4A:
+		DEBUG_MEMORY("Reading GPU window_y = %X\n", gp->reg.window_y);
+		return gp->reg.window_y;
+	default:
+		DEBUG_MEMORY("Reading GPU window_x = %X\n", gp->reg.window_x);
+		return gp->reg.window_x;
+	}
+}
 
-	gp->surface = SDL_SetVideoMode(SCREEN_WIDTH, SCREEN_HEIGHT, 8, SDL_HWSURFACE);
-	if (gp->surface == NULL)
-		ERROR("Unable to get the SDL surface: %s\n", SDL_GetError());
+static void gpu_write(void* dev, uint16_t addr, uint8_t value) {
+	gpu *gp = dev;
 
-	// Fill with white
-	if (SDL_FillRect(gp->surface, NULL, SDL_MapRGB(gp->surface->format, 0xFF, 0xFF, 0xFF)) == -1)
-		ERROR("Unable to fill surface with white: %s\n", SDL_GetError());
+	switch (addr) {
+	case 0xFF40:
+		DEBUG_MEMORY("Setting GPU LCD control to %x\n", value);
+		gp->reg.control = value;
+		break;
+	case 0xFF41:
+		// Mode & coincidence flags are read only
+		DEBUG_MEMORY("Setting GPU LCD_status to %x\n", value);
+		gp->reg.status = (value & 0x78) | (gp->reg.status & 0x07);
+		break;
+	case 0xFF42:
+		DEBUG_MEMORY("Setting GPU scroll_y to %x\n", value);
+		gp->reg.scroll_y = value;
+		break;
+	case 0xFF43:
+		DEBUG_MEMORY("Setting GPU scroll_x to %x\n", value);
+		gp->reg.scroll_x = value;
+		break;
+	case 0xFF44:
+		WARN("Writing read only GPU scanline register.\n");
+		break;
+	case 0xFF45:
+		DEBUG_MEMORY("Setting GPU check scanline to %x\n", value);
+		gp->reg.check_line = value;
+		gpu_check_line(gp);
+		break;
+	case 0xFF47:
+		DEBUG_MEMORY("Setting GPU background palette to %x\n", value);
+		gp->reg.bg_pal = value;
+		break;
+	case 0xFF48:
+		DEBUG_MEMORY("Setting GPU sprite palette 0 to %x\n", value);
+		gp->reg.sp_pal_0 = value;
+		break;
+	case 0xFF49:
+		DEBUG_MEMORY("Setting GPU sprite palette 1 to %x\n", value);
+		gp->reg.sp_pal_1 = value;
+		break;
+	case 0xFF4A:
+		DEBUG_MEMORY("Setting GPU window_y to %x\n", value);
+		gp->reg.window_y = value;
+		break;
+	default:
+		DEBUG_MEMORY("Setting GPU window_x to %x\n", value);
+		gp->reg.window_x = value;
+		break;
+	}
+}
+
+gpu* gpu_init(memory *mem, presenter *pr) {
+	gpu* gp = malloc(sizeof(gpu));
+	if (gp == NULL)
+		ERROR("Unable to allocate memory for gpu.\n");
 
-	if (SDL_Flip(gp->surface) == -1)
-		ERROR("Unable to flip surface at init: %s\n", SDL_GetError());
+	gp->pr = pr;
+	gp->rc = NULL;
 
 	gp->vram = calloc(0x2000, sizeof(uint8_t));
 	if (gp->vram == NULL)
@@ -33,9 +131,16 @@ gpu* gpu_init(memory *mem) {
 	gp->oam = calloc(0xA0, sizeof(uint8_t));
 	if (gp->oam == NULL)
 		ERROR("Unable to allocate memory for graphics sprites.\n");
+
+	// Blank frame
+	memset(gp->framebuffer, 0, sizeof(gp->framebuffer));
+	gp->sprite_count = 0;
+
+	// Tiles are decoded on first use
+	memset(gp->tiles_dirty, 1, sizeof(gp->tiles_dirty));
+	gpu_simd_init();
 	memory_set_gpu(mem, gp);
 
-	gp->state_start_clock = 0;
 	gp->reg.control = 0;
 	gp->reg.status = 0;
 	gp->reg.cur_line = 0;
@@ -44,8 +149,24 @@ gpu* gpu_init(memory *mem) {
 	gp->reg.bg_pal = 0;
 	gp->reg.sp_pal_0 = 0;
 	gp->reg.sp_pal_1 = 0;
+	gp->reg.window_y = 0;
+	gp->reg.window_x = 0;
+	gp->window_line = 0;
+	gpu_set_frameskip(gp, 0, NULL);
 	GPU_SET_MODE(gp, GPU_SCAN_VRAM);
 
+	// Mode changes are driven by the scheduler
+	gp->ir = mem->ir;
+	gp->sch = mem->sch;
+	gp->ev = scheduler_add_event(gp->sch, gpu_process, gp);
+	scheduler_schedule(gp->sch, gp->ev, gp->sch->now + GPU_SCAN_VRAM_TIMING);
+
+	// Registers, DMA (0xFF46) is handled by the memory
+	uint16_t addr = 0;
+	for (addr = 0xFF40; addr <= 0xFF4B; addr++)
+		if (addr != 0xFF46)
+			memory_register_io(mem, addr, gpu_read, gpu_write, gp);
+
 	// Check if size is ok for oam data
 	if (sizeof(oam_data) != 4 * sizeof(uint8_t))
 		ERROR("Size of oam_data (%lu) != %lu\n", sizeof(oam_data), sizeof(uint8_t));
@@ -54,246 +175,287 @@ gpu* gpu_init(memory *mem) {
 }
 
 void gpu_end(gpu *gp) {
-	SDL_Quit();
 	free(gp->vram);
 	free(gp->oam);
 	free(gp);
 }
 
-static uint8_t get_tile_pixel_value(gpu *gp, uint16_t tile_addr, uint8_t tile_x, uint8_t tile_y) {
-	tile_addr += tile_y * TILE_ENCODED_SIZE;
-
-	uint8_t tile_content_first = gp->vram[tile_addr];
-	uint8_t tile_content_second = gp->vram[tile_addr + 1];
-
-	uint8_t pixel_first = (tile_content_first & (1 << (7 - tile_x))) >> (7 - tile_x);
-	uint8_t pixel_second = (tile_content_second & (1 << (7 - tile_x))) >> (7 - tile_x);
-	uint8_t pixel_value = pixel_first | (pixel_second << 1);
+// Decoded tile, decoded again only when its VRAM bytes were written
+static inline gpu_tile* gpu_get_tile(gpu *gp, uint16_t index) {
+	gpu_tile *tile = &(gp->tiles[index]);
+	if (!gp->tiles_dirty[index])
+		return tile;
+
+	uint8_t* data = gp->vram + index * TILE_SIZE;
+	uint8_t y = 0, x = 0;
+	for (y = 0; y < TILE_HEIGHT; y++) {
+		gpu_simd_decode_tile_line(data[y * TILE_ENCODED_SIZE], data[y * TILE_ENCODED_SIZE + 1], tile->values[y]);
+		for (x = 0; x < TILE_WIDTH; x++)
+			tile->flipped[y][x] = tile->values[y][TILE_WIDTH - 1 - x];
+	}
 
-	assert(pixel_value >=0 && pixel_value <= 3);
-	return pixel_value;
+	gp->tiles_dirty[index] = 0;
+	return tile;
 }
 
-static uint8_t gpu_get_bg_pixel_value(gpu *gp, uint8_t x, uint8_t y) {
-	assert(x < MAP_TOTAL_WIDTH && y < MAP_TOTAL_HEIGHT);
-
-	// Get map offset
-	uint16_t map_offset = ((gp->reg.control & (1 << 3)) == 0 ? 0x9800 : 0x9C00);
-	map_offset -= 0x8000;
-	map_offset += (y / 8) * MAP_LINE_WIDTH + x / 8;
-
-	uint8_t tile_offset = gp->vram[map_offset];
-
-	// Get tile
-	uint16_t tile_addr = NULL;
+// Tile of a background map entry
+static inline uint16_t gpu_bg_tile(gpu *gp, uint8_t tile_offset) {
 	if ((gp->reg.control & (1 << 4)) == 0)
-		tile_addr = (0x9000 - 0x8000) + ((int8_t)tile_offset) * TILE_HEIGHT * TILE_ENCODED_SIZE;
-	else
-		tile_addr = (0x8000 - 0x8000) + tile_offset * TILE_HEIGHT * TILE_ENCODED_SIZE;
-
-	// Convert map coordinates to tile coordinate
-	uint8_t tile_x = (x % 8);
-	uint8_t tile_y = (y % 8);
+		return 0x100 + (int8_t)tile_offset;
 
-	return get_tile_pixel_value(gp, tile_addr, tile_x, tile_y);
+	return tile_offset;
 }
 
-static uint8_t gpu_get_bg_pixel_color(gpu *gp, uint8_t x, uint8_t y) {
-	uint8_t pixel_value = gpu_get_bg_pixel_value(gp, x, y);
-
-	// Convert using current pal
-	return (gp->reg.bg_pal & (3 << (pixel_value * 2))) >> (pixel_value * 2);
+// VRAM offset of a map first line, selected by an LCD control bit: 3 for
+// the background, 6 for the window
+static inline uint16_t gpu_map_addr(gpu *gp, uint8_t bit) {
+	return ((gp->reg.control & (1 << bit)) == 0 ? 0x9800 : 0x9C00) - 0x8000;
 }
 
-static uint8_t gpu_get_sprite_pixel_color(gpu *gp, oam_data *obj, uint8_t x, uint8_t y, uint8_t *error) {
-	// Reset error before beginning
-	*error = 0;
-
-	// Get tile
-	uint8_t tile_offset = obj->tile;
-	uint16_t tile_addr = tile_offset * TILE_HEIGHT * TILE_ENCODED_SIZE;
+// Colors of a palette register
+static inline void gpu_decode_palette(uint8_t pal, uint8_t *colors) {
+	colors[0] = pal & 0x3;
+	colors[1] = (pal >> 2) & 0x3;
+	colors[2] = (pal >> 4) & 0x3;
+	colors[3] = (pal >> 6) & 0x3;
+}
 
-	// Correct obj_y & obj_x
-	int16_t obj_y = obj->y - 16;
-	int16_t obj_x = obj->x - 8;
+// Copy whole the count tiles of a map line from map_x in values, wrapping
+// around the map. Used by both the background and the window.
+static void gpu_fetch_map_line(gpu *gp, uint16_t map_addr, uint8_t y, uint8_t map_x, uint8_t count, uint8_t *values) {
+	uint8_t tile_y = y % 8;
+	uint8_t i = 0;
 
-	// Check if inside the map
-	if (obj_x + x < 0 || obj_x + x >= SCREEN_WIDTH) {
-		*error = 1;
-		return 0;
+	map_addr += (y / 8) * MAP_LINE_WIDTH;
+	for (i = 0; i < count; i++) {
+		gpu_tile *tile = gpu_get_tile(gp, gpu_bg_tile(gp, gp->vram[map_addr + ((map_x + i) % MAP_LINE_WIDTH)]));
+		memcpy(values + i * TILE_WIDTH, tile->values[tile_y], TILE_WIDTH);
 	}
+}
 
-	// Get tile coordinates
-	uint8_t tile_y = (obj->options & (1 << 6)) ? (TILE_HEIGHT - 1) - (y - obj_y) : y - obj_y;
-	assert(tile_y >= 0 && tile_y < TILE_HEIGHT);
-	uint8_t tile_x = (obj->options & (1 << 5)) ? (TILE_HEIGHT - 1) - x : x;
+// Render the background of the current line, tile after tile. The line
+// begins scroll_x % 8 pixels in the fetched tiles. Return the pixel values of
+// the line, used for sprites priority.
+static uint8_t* gpu_render_bg(gpu *gp, uint8_t *values, uint8_t *colors, uint8_t *pal) {
+	uint8_t y = gp->reg.cur_line + gp->reg.scroll_y;
+	gpu_fetch_map_line(gp, gpu_map_addr(gp, 3), y, gp->reg.scroll_x / 8, SCREEN_WIDTH / TILE_WIDTH + 1, values);
 
-	uint8_t pixel_value = get_tile_pixel_value(gp, tile_addr, tile_x, tile_y);
+	uint8_t *line = values + (gp->reg.scroll_x % 8);
+	gpu_simd_map(line, pal, colors, SCREEN_WIDTH);
+	return line;
+}
 
-	// 00 is transparent
-	if (pixel_value == 0) {
-		*error = 1;
-		return 0;
-	}
+// Render the window over the background of the current line, from screen
+// x = window_x - 7 to the right border. The window has its own line counter,
+// only incremented on lines where it is shown.
+static void gpu_render_window(gpu *gp, uint8_t *bg, uint8_t *colors, uint8_t *pal) {
+	if (gp->reg.cur_line < gp->reg.window_y || gp->reg.window_x >= SCREEN_WIDTH + 7)
+		return;
 
-	// Check if need to draw
-	uint8_t bg_value = gpu_get_bg_pixel_value(gp, x, y);
-	if (bg_value && (obj->options & (1 << 7))) {
-		*error = 1;
-		return 0;
-	}
+	// A window_x below 7 hides the window first pixels
+	uint8_t start = gp->reg.window_x < 7 ? 0 : gp->reg.window_x - 7;
+	uint8_t skip = gp->reg.window_x < 7 ? 7 - gp->reg.window_x : 0;
+	uint8_t width = SCREEN_WIDTH - start;
+	uint8_t values[SCREEN_WIDTH + TILE_WIDTH];
 
-	// Convert using good pal
-	uint8_t pal = (obj->options & (1 << 4)) ? gp->reg.sp_pal_1 : gp->reg.sp_pal_0;
-	return (pal & (3 << (pixel_value * 2))) >> (pixel_value * 2);
+	gpu_fetch_map_line(gp, gpu_map_addr(gp, 6), gp->window_line, 0, (skip + width + TILE_WIDTH - 1) / TILE_WIDTH, values);
+	memcpy(bg + start, values + skip, width);
+	gpu_simd_map(bg + start, pal, colors + start, width);
+	gp->window_line++;
 }
 
-static void draw_pixel_on_surface(SDL_Surface *surface, uint8_t x, uint8_t y, uint8_t pixel_color) {
-	SDL_LockSurface(surface);
-	uint8_t* pixel = surface->pixels + y * surface->w + x;
-	switch(pixel_color) {
-	case 0:
-		*pixel = 0xFF;
-		break;
-	case 1:
-		*pixel = 0xC0;
-		break;
-	case 2:
-		*pixel = 0x60;
-		break;
-	case 3:
-		*pixel = 0x00;
-		break;
+// Sprites height, from the LCD control
+static inline uint8_t gpu_sprite_height(gpu *gp) {
+	return (gp->reg.control & (1 << 2)) ? 2 * SPRITE_HEIGHT : SPRITE_HEIGHT;
+}
+
+// OAM search, select the first SPRITE_LINE_MAX sprites on the current line
+// then sort them by priority: lowest x first, then lowest OAM index.
+static void gpu_search_oam(gpu *gp) {
+	oam_data* data = (oam_data*)gp->oam;
+	uint8_t height = gpu_sprite_height(gp);
+	uint8_t line = gp->reg.cur_line + 16;
+	uint8_t i = 0;
+
+	gp->sprite_count = 0;
+	for (i = 0; i < SPRITE_COUNT && gp->sprite_count < SPRITE_LINE_MAX; i++) {
+		if (line < data[i].y || line >= data[i].y + height)
+			continue;
+
+		// Insertion keeps the OAM order between sprites at the same x
+		uint8_t j = gp->sprite_count++;
+		for (; j > 0 && data[gp->sprites[j - 1]].x > data[i].x; j--)
+			gp->sprites[j] = gp->sprites[j - 1];
+		gp->sprites[j] = i;
 	}
+}
 
-	SDL_UnlockSurface(surface);
+// Draw the sprites selected by the OAM search over the line. On each pixel,
+// the first opaque sprite pixel wins, even when it is hidden by the background.
+static void gpu_render_sprites(gpu *gp, uint8_t *bg, uint8_t *colors) {
+	oam_data* data = (oam_data*)gp->oam;
+	uint8_t height = gpu_sprite_height(gp);
+	uint8_t drawn[SCREEN_WIDTH];
+	uint8_t i = 0, x = 0;
+
+	memset(drawn, 0, sizeof(drawn));
+	for (i = 0; i < gp->sprite_count; i++) {
+		oam_data* obj = &(data[gp->sprites[i]]);
+		uint8_t pal[4];
+		gpu_decode_palette((obj->options & (1 << 4)) ? gp->reg.sp_pal_1 : gp->reg.sp_pal_0, pal);
+
+		// Tile line, 8x16 sprites are made of two consecutive tiles
+		uint8_t tile_y = gp->reg.cur_line + 16 - obj->y;
+		if (obj->options & (1 << 6))
+			tile_y = height - 1 - tile_y;
+
+		uint16_t index = (height > SPRITE_HEIGHT ? obj->tile & 0xFE : obj->tile) + tile_y / TILE_HEIGHT;
+		gpu_tile *tile = gpu_get_tile(gp, index);
+		uint8_t *values = (obj->options & (1 << 5)) ? tile->flipped[tile_y % TILE_HEIGHT] : tile->values[tile_y % TILE_HEIGHT];
+
+		for (x = 0; x < SPRITE_WIDTH; x++) {
+			int16_t screen_x = obj->x - 8 + x;
+			if (screen_x < 0 || screen_x >= SCREEN_WIDTH)
+				continue;
+
+			// 00 is transparent
+			if (values[x] == 0 || drawn[screen_x])
+				continue;
+
+			drawn[screen_x] = 1;
+			if ((obj->options & (1 << 7)) && bg[screen_x])
+				continue;
+
+			colors[screen_x] = pal[values[x]];
+		}
+	}
 }
 
 static void gpu_render(gpu *gp) {
-	uint8_t x = 0;
+	uint8_t *colors = gp->framebuffer[gp->reg.cur_line];
+	uint8_t values[SCREEN_WIDTH + TILE_WIDTH];
+	uint8_t *bg = values;
 
 	// Check LCD is on before rendering
 	if ((gp->reg.control & 0x80) == 0)
 		return;
 
-	// Render BG
+	// Render BG & window, white when disabled
 	if (gp->reg.control & 0x1) {
-		// Wrap y
-		uint16_t wy = gp->reg.cur_line + gp->reg.scroll_y;
-		if (wy > MAP_TOTAL_HEIGHT)
-			wy -= MAP_TOTAL_HEIGHT;
+		uint8_t pal[4];
+		gpu_decode_palette(gp->reg.bg_pal, pal);
+		bg = gpu_render_bg(gp, values, colors, pal);
 
-		for (x = 0; x < SCREEN_WIDTH; x++) {
-			// Wrap x
-			uint16_t wx = x + gp->reg.scroll_x;
-			if (wx > MAP_TOTAL_WIDTH)
-				wx -= MAP_TOTAL_WIDTH;
-
-			uint8_t pixel_color = gpu_get_bg_pixel_color(gp, wx, wy);
-
-			// Draw pixel
-			draw_pixel_on_surface(gp->surface, x, gp->reg.cur_line, pixel_color);
-		}
+		if (gp->reg.control & 0x20)
+			gpu_render_window(gp, bg, colors, pal);
+	} else {
+		memset(values, 0, SCREEN_WIDTH);
+		memset(colors, 0, SCREEN_WIDTH);
 	}
 
 	// Render sprite
-	if (gp->reg.control & 0x2) {
-		uint8_t i = 0;
-		oam_data* data = (oam_data*)gp->oam;
-
-		for (i = 0; i < SPRITE_COUNT; i++) {
-			oam_data* obj = &(data[i]);
-
-			// Correct obj_y & obj_x
-			uint8_t obj_y = obj->y - 16;
-			uint8_t obj_x = obj->x - 8;
-
-			// Sprite is on the cur line
-			if (obj_y <= gp->reg.cur_line && (obj_y + SPRITE_HEIGHT) > gp->reg.cur_line) {
-				uint8_t x = 0;
-				for (x = 0; x < SPRITE_WIDTH; x++) {
-					uint8_t error = 0;
-					uint8_t pixel_color = gpu_get_sprite_pixel_color(gp, obj, x, gp->reg.cur_line, &error);
-
-					// Constraints are handled by gpu_get_sprite_pixel_color
-					if (!error) {
-						draw_pixel_on_surface(gp->surface, obj_x + x, gp->reg.cur_line, pixel_color);
-					}
-				}
-			}
-		}
-	}
+	if (gp->reg.control & 0x2)
+		gpu_render_sprites(gp, bg, colors);
+}
+
+// Skip frames frames between two drawn ones, or when pc is not NULL as many
+// as needed to keep up with its deadlines
+void gpu_set_frameskip(gpu *gp, uint8_t frames, pacer *pc) {
+	gp->frameskip = frames;
+	gp->pc = pc;
+	gp->skipped = 0;
+	gp->skip_frame = 0;
+}
+
+// Frames are recorded at vertical blank, a skipped frame repeats the last
+// drawn one
+void gpu_set_recorder(gpu *gp, recorder *rc) {
+	gp->rc = rc;
+}
+
+// Choose at the first line whether the frame is drawn
+static void gpu_start_frame(gpu *gp) {
+	uint8_t skip = 0;
+	if (gp->pc != NULL)
+		skip = gp->pc->late && gp->skipped < GPU_MAX_FRAMESKIP;
+	else
+		skip = gp->skipped < gp->frameskip;
+
+	gp->skip_frame = skip;
+	gp->skipped = skip ? gp->skipped + 1 : 0;
 }
 
 // Timing from http://imrannazar.com/GameBoy-Emulation-in-JavaScript:-GPU-Timings
-void gpu_process(gpu* gp, interrupts* ir, uint16_t clock) {
+// Scheduler event run at the end of each mode, schedule the next one
+void gpu_process(void* dev, uint64_t now) {
+	gpu* gp = dev;
+	interrupts* ir = gp->ir;
+	uint16_t timing = 0;
 
-	gp->state_start_clock += clock;
 	switch(GPU_GET_MODE(gp)) {
 	case GPU_HORIZ_BLANK:
-		if (gp->state_start_clock >= GPU_HORIZ_BLANK_TIMING) {
-			gp->state_start_clock = 0;
-			gp->reg.cur_line++;
+		gp->reg.cur_line++;
 
-			if (gp->reg.cur_line == SCREEN_HEIGHT) {
-				GPU_SET_MODE(gp, GPU_VERT_BLANK);
-				// Redraw surface
-				SDL_Flip(gp->surface);
+		if (gp->reg.cur_line == SCREEN_HEIGHT) {
+			GPU_SET_MODE(gp, GPU_VERT_BLANK);
+			timing = GPU_VERT_BLANK_TIMING / GPU_VERT_BLANK_LINES;
+			gp->window_line = 0;
 
-				// Raise irq
-				if (gp->reg.control & 0x80)
-					interrupts_raise(ir, IRQ_VBLANK);
+			// Redraw surface
+			if (!gp->skip_frame)
+				presenter_publish(gp->pr, gp->framebuffer);
+			if (gp->rc != NULL)
+				recorder_push(gp->rc, gp->framebuffer);
 
-				if ((gp->reg.status & (1 << 4)))
-					interrupts_raise(ir, IRQ_LCD);
+			// Raise irq
+			if (gp->reg.control & 0x80)
+				interrupts_raise(ir, IRQ_VBLANK);
 
-			} else {
-				if ((gp->reg.status & (1 << 5)) && gp->reg.cur_line < SCREEN_HEIGHT)
-					interrupts_raise(ir, IRQ_LCD);
+			if ((gp->reg.status & (1 << 4)))
+				interrupts_raise(ir, IRQ_LCD);
+
+		} else {
+			if ((gp->reg.status & (1 << 5)) && gp->reg.cur_line < SCREEN_HEIGHT)
+				interrupts_raise(ir, IRQ_LCD);
 
-				GPU_SET_MODE(gp, GPU_SCAN_OAM);
-			}
+			GPU_SET_MODE(gp, GPU_SCAN_OAM);
+			timing = GPU_SCAN_OAM_TIMING;
 		}
 		break;
 	case GPU_VERT_BLANK:
-		if (gp->state_start_clock >= GPU_VERT_BLANK_TIMING) {
-			gp->state_start_clock = 0;
-			gp->reg.cur_line++;
-
-			if (gp->reg.cur_line > SCREEN_HEIGHT + 10) {
-				GPU_SET_MODE(gp, GPU_HORIZ_BLANK);
-				gp->reg.cur_line = 0;
-				gpu_render(gp);
-			}
+		gp->reg.cur_line++;
+		timing = GPU_VERT_BLANK_TIMING / GPU_VERT_BLANK_LINES;
+
+		// Back to the first line
+		if (gp->reg.cur_line == SCREEN_HEIGHT + GPU_VERT_BLANK_LINES) {
+			gp->reg.cur_line = 0;
+			gpu_start_frame(gp);
+			if ((gp->reg.status & (1 << 5)))
+				interrupts_raise(ir, IRQ_LCD);
+
+			GPU_SET_MODE(gp, GPU_SCAN_OAM);
+			timing = GPU_SCAN_OAM_TIMING;
 		}
 		break;
 	case GPU_SCAN_OAM:
-		if (gp->state_start_clock >= GPU_SCAN_OAM_TIMING) {
-			gp->state_start_clock = 0;
-			GPU_SET_MODE(gp, GPU_SCAN_VRAM);
-		}
+		if (!gp->skip_frame)
+			gpu_search_oam(gp);
+		GPU_SET_MODE(gp, GPU_SCAN_VRAM);
+		timing = GPU_SCAN_VRAM_TIMING;
 		break;
 	case GPU_SCAN_VRAM:
-		if (gp->state_start_clock >= GPU_SCAN_VRAM_TIMING) {
-			if ((gp->reg.status & (1 << 3)) && gp->reg.cur_line < SCREEN_HEIGHT)
-				interrupts_raise(ir, IRQ_LCD);
+		if ((gp->reg.status & (1 << 3)) && gp->reg.cur_line < SCREEN_HEIGHT)
+			interrupts_raise(ir, IRQ_LCD);
 
-			gp->state_start_clock = 0;
-			GPU_SET_MODE(gp, GPU_HORIZ_BLANK);
+		GPU_SET_MODE(gp, GPU_HORIZ_BLANK);
+		timing = GPU_HORIZ_BLANK_TIMING;
 
-			// Render one line
-			if (gp->reg.cur_line < SCREEN_HEIGHT)
-				gpu_render(gp);
-		}
+		// Render one line
+		if (gp->reg.cur_line < SCREEN_HEIGHT && !gp->skip_frame)
+			gpu_render(gp);
 		break;
 	}
 
-	// Check LY == LYC
-	if (gp->reg.cur_line == gp->reg.check_line) {
-		gp->reg.status |= (1 << 2);
-		if (gp->reg.status & (1 << 6))
-			interrupts_raise(ir, IRQ_LCD);
-	} else {
-		gp->reg.status &= ~(1 << 2);
-	}
+	gpu_check_line(gp);
+	scheduler_schedule(gp->sch, gp->ev, now + timing);
 }
@@ -1,7 +1,7 @@
 #ifndef __GPU_H__
 #define __GPU_H__
 
-#include <SDL/SDL.h>
+#include <stdint.h>
 
 #define SCREEN_WIDTH 160
 #define SCREEN_HEIGHT 144
@@ -11,12 +11,19 @@
 #define TILE_HEIGHT 8
 
 #define TILE_ENCODED_SIZE (sizeof(uint16_t))
+#define TILE_SIZE (TILE_HEIGHT * TILE_ENCODED_SIZE)
+#define TILE_COUNT 384 // Tile data from 0x8000 to 0x97FF
 #define MAP_TOTAL_WIDTH (MAP_LINE_WIDTH * TILE_WIDTH)
 #define MAP_TOTAL_HEIGHT (MAP_LINE_HEIGHT * TILE_HEIGHT)
 
 #define SPRITE_COUNT 40
 #define SPRITE_HEIGHT 8
 #define SPRITE_WIDTH 8
+#define SPRITE_LINE_MAX 10 // Sprites shown on a single line
+
+#define GPU_VERT_BLANK_LINES 10
+#define GPU_MAX_FRAMESKIP 8    // Consecutive frames skipped to keep up at most
+#define GPU_FRAME_TIMING 17556 // Cycles per frame
 
 typedef enum {
 	GPU_HORIZ_BLANK,
@@ -39,15 +46,64 @@ typedef struct {
 	uint8_t options;
 } oam_data;
 
+// Pixel values (0-3) of a tile, as is and horizontally flipped
+typedef struct gpu_tile {
+	uint8_t values[TILE_HEIGHT][TILE_WIDTH];
+	uint8_t flipped[TILE_HEIGHT][TILE_WIDTH];
+} gpu_tile;
+
 typedef struct memory memory;
+typedef struct presenter presenter;
+typedef struct pacer pacer;
+typedef struct recorder recorder;
 typedef struct interrupts interrupts;
+typedef struct scheduler scheduler;
+typedef struct scheduler_event scheduler_event;
+
+// Video output, the screen is made of 8 bits shades from 0xFF (white) to
+// 0x00 (black). Only used from the presenter thread.
+typedef struct gpu_backend {
+	void* (*init)(uint16_t width, uint16_t height); // Open the screen, white filled
+	void (*end)(void* data);
+	uint8_t* (*lock)(void* data, uint16_t* pitch); // Access the screen pixels
+	void (*unlock)(void* data);
+	void (*flip)(void* data);                      // Show the completed frame
+	void (*pump)(void* data);                      // Handle the window events
+} gpu_backend;
+
+extern const gpu_backend gpu_backend_sdl;
+extern const gpu_backend gpu_backend_headless;
 
 typedef struct gpu {
-	SDL_Surface *surface;
-	uint16_t state_start_clock;
+	presenter *pr;
+	recorder *rc; // Gets every frame when not NULL, even skipped ones
+	interrupts *ir;
+	scheduler *sch;
+	scheduler_event *ev; // End of the current mode
 	uint8_t* vram;
 	uint8_t* oam;
 
+	// Sprites of the current line by priority, from the OAM search
+	uint8_t sprites[SPRITE_LINE_MAX];
+	uint8_t sprite_count;
+
+	// Window line to render next, restarts at each frame
+	uint8_t window_line;
+
+	// Frame skipping, timings and interrupts are kept on skipped frames but
+	// nothing is drawn nor shown
+	uint8_t frameskip;   // Frames skipped between two drawn ones
+	pacer *pc;           // Skip frames while late on it, instead of frameskip
+	uint8_t skipped;     // Frames skipped in a row
+	uint8_t skip_frame;  // Current frame is not drawn
+
+	// Palette colors (0-3) of the frame, shown at vertical blank
+	uint8_t framebuffer[SCREEN_HEIGHT][SCREEN_WIDTH];
+
+	// Decoded tile data, a tile is decoded again after a write to its bytes
+	gpu_tile tiles[TILE_COUNT];
+	uint8_t tiles_dirty[TILE_COUNT];
+
 	struct {
 		uint8_t control;
 		uint8_t status;
@@ -58,10 +114,19 @@ typedef struct gpu {
 		uint8_t bg_pal;
 		uint8_t sp_pal_0;
 		uint8_t sp_pal_1;
+		uint8_t window_y;
+		uint8_t window_x;
 	} reg;
 } gpu;
 
-gpu* gpu_init(memory *mem);
+gpu* gpu_init(memory *mem, presenter *pr);
 void gpu_end(gpu* gp);
-void gpu_process(gpu *gp, interrupts *ir, uint16_t clock);
+void gpu_process(void* dev, uint64_t now);
+void gpu_set_frameskip(gpu *gp, uint8_t frames, pacer *pc);
+void gpu_set_recorder(gpu *gp, recorder *rc);
+
+// Tile data at addr (0x8000-0x97FF) was written
+static inline void gpu_invalidate_tile(gpu *gp, uint16_t addr) {
+	gp->tiles_dirty[(addr - 0x8000) / TILE_SIZE] = 1;
+}
 #endif     // __GPU_H__
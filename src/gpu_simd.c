@@ -0,0 +1,163 @@
+#include "log.h"
+#include "gpu_simd.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define GPU_SIMD_X86
+#endif
+
+static void gpu_simd_map_scalar(const uint8_t *values, const uint8_t *table, uint8_t *out, uint16_t count) {
+	uint16_t i = 0;
+	for (i = 0; i < count; i++)
+		out[i] = table[values[i]];
+}
+
+static void gpu_simd_widen_scalar(const uint8_t *values, uint8_t *out, uint16_t count, uint8_t factor) {
+	uint16_t i = 0;
+	for (i = 0; i < count; i++) {
+		memset(out, values[i], factor);
+		out += factor;
+	}
+}
+
+// Scale2x rules, a corner takes the neighbours color when they form an edge
+#define GPU_SIMD_SCALE2X_PIXEL(B, D, E, F, H, out0, out1) do {                 \
+		(out0)[0] = ((D) == (B) && (B) != (F) && (D) != (H)) ? (D) : (E);  \
+		(out0)[1] = ((B) == (F) && (B) != (D) && (F) != (H)) ? (F) : (E);  \
+		(out1)[0] = ((D) == (H) && (D) != (B) && (H) != (F)) ? (D) : (E);  \
+		(out1)[1] = ((H) == (F) && (D) != (H) && (B) != (F)) ? (F) : (E);  \
+	} while (0)
+
+static void gpu_simd_scale2x_scalar(const uint8_t *above, const uint8_t *line, const uint8_t *below,
+                                    uint8_t *out0, uint8_t *out1, uint16_t count) {
+	uint16_t i = 0;
+	for (i = 0; i < count; i++)
+		GPU_SIMD_SCALE2X_PIXEL(above[i], line[i - 1], line[i], line[i + 1], below[i], out0 + 2 * i, out1 + 2 * i);
+}
+
+#ifdef GPU_SIMD_X86
+// No byte shuffle before SSSE3, each entry is selected with a compare
+__attribute__((target("sse2")))
+static void gpu_simd_map_sse2(const uint8_t *values, const uint8_t *table, uint8_t *out, uint16_t count) {
+	__m128i entries[4];
+	__m128i indexes[4];
+	uint8_t j = 0;
+	for (j = 0; j < 4; j++) {
+		entries[j] = _mm_set1_epi8(table[j]);
+		indexes[j] = _mm_set1_epi8(j);
+	}
+
+	uint16_t i = 0;
+	for (i = 0; i + 16 <= count; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(values + i));
+		__m128i r = _mm_and_si128(_mm_cmpeq_epi8(v, indexes[0]), entries[0]);
+		r = _mm_or_si128(r, _mm_and_si128(_mm_cmpeq_epi8(v, indexes[1]), entries[1]));
+		r = _mm_or_si128(r, _mm_and_si128(_mm_cmpeq_epi8(v, indexes[2]), entries[2]));
+		r = _mm_or_si128(r, _mm_and_si128(_mm_cmpeq_epi8(v, indexes[3]), entries[3]));
+		_mm_storeu_si128((__m128i*)(out + i), r);
+	}
+
+	gpu_simd_map_scalar(values + i, table, out + i, count - i);
+}
+
+// Select c ? a : b on each byte
+__attribute__((target("sse2")))
+static inline __m128i gpu_simd_select_sse2(__m128i c, __m128i a, __m128i b) {
+	return _mm_or_si128(_mm_and_si128(c, a), _mm_andnot_si128(c, b));
+}
+
+// 16 pixels at once, the four corners are interleaved back in two lines
+__attribute__((target("sse2")))
+static void gpu_simd_scale2x_sse2(const uint8_t *above, const uint8_t *line, const uint8_t *below,
+                                  uint8_t *out0, uint8_t *out1, uint16_t count) {
+	uint16_t i = 0;
+	for (i = 0; i + 16 <= count; i += 16) {
+		__m128i B = _mm_loadu_si128((const __m128i*)(above + i));
+		__m128i D = _mm_loadu_si128((const __m128i*)(line + i - 1));
+		__m128i E = _mm_loadu_si128((const __m128i*)(line + i));
+		__m128i F = _mm_loadu_si128((const __m128i*)(line + i + 1));
+		__m128i H = _mm_loadu_si128((const __m128i*)(below + i));
+
+		__m128i DB = _mm_cmpeq_epi8(D, B);
+		__m128i BF = _mm_cmpeq_epi8(B, F);
+		__m128i DH = _mm_cmpeq_epi8(D, H);
+		__m128i HF = _mm_cmpeq_epi8(H, F);
+
+		__m128i E0 = gpu_simd_select_sse2(_mm_andnot_si128(_mm_or_si128(BF, DH), DB), D, E);
+		__m128i E1 = gpu_simd_select_sse2(_mm_andnot_si128(_mm_or_si128(DB, HF), BF), F, E);
+		__m128i E2 = gpu_simd_select_sse2(_mm_andnot_si128(_mm_or_si128(DB, HF), DH), D, E);
+		__m128i E3 = gpu_simd_select_sse2(_mm_andnot_si128(_mm_or_si128(DH, BF), HF), F, E);
+
+		_mm_storeu_si128((__m128i*)(out0 + 2 * i), _mm_unpacklo_epi8(E0, E1));
+		_mm_storeu_si128((__m128i*)(out0 + 2 * i + 16), _mm_unpackhi_epi8(E0, E1));
+		_mm_storeu_si128((__m128i*)(out1 + 2 * i), _mm_unpacklo_epi8(E2, E3));
+		_mm_storeu_si128((__m128i*)(out1 + 2 * i + 16), _mm_unpackhi_epi8(E2, E3));
+	}
+
+	gpu_simd_scale2x_scalar(above + i, line + i, below + i, out0 + 2 * i, out1 + 2 * i, count - i);
+}
+
+// 16 values are shuffled into factor blocks of 16, one control per block
+__attribute__((target("ssse3")))
+static void gpu_simd_widen_ssse3(const uint8_t *values, uint8_t *out, uint16_t count, uint8_t factor) {
+	__m128i controls[GPU_SIMD_MAX_FACTOR];
+	uint8_t control[16];
+	uint8_t j = 0, k = 0;
+	for (j = 0; j < factor; j++) {
+		for (k = 0; k < 16; k++)
+			control[k] = (16 * j + k) / factor;
+		controls[j] = _mm_loadu_si128((const __m128i*)control);
+	}
+
+	uint16_t i = 0;
+	for (i = 0; i + 16 <= count; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(values + i));
+		for (j = 0; j < factor; j++)
+			_mm_storeu_si128((__m128i*)(out + i * factor + 16 * j), _mm_shuffle_epi8(v, controls[j]));
+	}
+
+	gpu_simd_widen_scalar(values + i, out + i * factor, count - i, factor);
+}
+
+// The table is a shuffle control, 32 values per instruction
+__attribute__((target("avx2")))
+static void gpu_simd_map_avx2(const uint8_t *values, const uint8_t *table, uint8_t *out, uint16_t count) {
+	uint32_t packed = 0;
+	memcpy(&packed, table, sizeof(packed));
+	__m256i lut = _mm256_set1_epi32(packed);
+
+	uint16_t i = 0;
+	for (i = 0; i + 32 <= count; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i*)(values + i));
+		_mm256_storeu_si256((__m256i*)(out + i), _mm256_shuffle_epi8(lut, v));
+	}
+
+	gpu_simd_map_scalar(values + i, table, out + i, count - i);
+}
+#endif
+
+gpu_simd_map_kernel gpu_simd_map = gpu_simd_map_scalar;
+gpu_simd_widen_kernel gpu_simd_widen = gpu_simd_widen_scalar;
+gpu_simd_scale2x_kernel gpu_simd_scale2x = gpu_simd_scale2x_scalar;
+
+void gpu_simd_init(void) {
+	gpu_simd_map = gpu_simd_map_scalar;
+	gpu_simd_widen = gpu_simd_widen_scalar;
+	gpu_simd_scale2x = gpu_simd_scale2x_scalar;
+
+#ifdef GPU_SIMD_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		DEBUG_GPU("Using AVX2 pixel kernels\n");
+		gpu_simd_map = gpu_simd_map_avx2;
+	} else if (__builtin_cpu_supports("sse2")) {
+		DEBUG_GPU("Using SSE2 pixel kernels\n");
+		gpu_simd_map = gpu_simd_map_sse2;
+	}
+
+	if (__builtin_cpu_supports("sse2"))
+		gpu_simd_scale2x = gpu_simd_scale2x_sse2;
+	if (__builtin_cpu_supports("ssse3"))
+		gpu_simd_widen = gpu_simd_widen_ssse3;
+#endif
+}
@@ -0,0 +1,48 @@
+#ifndef __GPU_SIMD_H__
+#define __GPU_SIMD_H__
+
+#include <stdint.h>
+#include <string.h>
+
+#define GPU_SIMD_MAX_FACTOR 6 // Largest widen factor
+
+// Pixel conversion kernels, the fastest one supported by the host is
+// selected at runtime by gpu_simd_init.
+
+// Map pixel values (0-3) through a 4 entries table
+typedef void (*gpu_simd_map_kernel)(const uint8_t *values, const uint8_t *table, uint8_t *out, uint16_t count);
+
+// Repeat each value factor times, for nearest neighbour upscaling
+typedef void (*gpu_simd_widen_kernel)(const uint8_t *values, uint8_t *out, uint16_t count, uint8_t factor);
+
+// Scale2x of a line, from the lines above and below, into two lines of
+// 2 * count values. The line is read from one value before its start to one
+// value after its end.
+typedef void (*gpu_simd_scale2x_kernel)(const uint8_t *above, const uint8_t *line, const uint8_t *below,
+                                        uint8_t *out0, uint8_t *out1, uint16_t count);
+
+extern gpu_simd_map_kernel gpu_simd_map;
+extern gpu_simd_widen_kernel gpu_simd_widen;
+extern gpu_simd_scale2x_kernel gpu_simd_scale2x;
+
+void gpu_simd_init(void);
+
+// Pixel values of a tile line from its two bitplanes, leftmost pixel first.
+// Each bitplane bit is moved to the low bit of its own byte by a single
+// multiply.
+static inline void gpu_simd_decode_tile_line(uint8_t first, uint8_t second, uint8_t *values) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	uint64_t low = ((first * 0x8040201008040201ULL) & 0x8080808080808080ULL) >> 7;
+	uint64_t high = ((second * 0x8040201008040201ULL) & 0x8080808080808080ULL) >> 6;
+	uint64_t line = low | high;
+	memcpy(values, &line, sizeof(line));
+#else
+	uint8_t x = 0;
+	for (x = 0; x < 8; x++) {
+		uint8_t shift = 7 - x;
+		values[x] = ((first >> shift) & 1) | (((second >> shift) & 1) << 1);
+	}
+#endif
+}
+
+#endif     // __GPU_SIMD_H__
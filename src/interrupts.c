@@ -3,8 +3,33 @@
 #include "interrupts.h"
 #include "emulator.h"
 #include "memory.h"
+#include "scheduler.h"
 #include "log.h"
 
+static uint8_t interrupts_read(void* dev, uint16_t addr) {
+	interrupts *ir = dev;
+
+	if (addr == 0xFF0F) {
+		DEBUG_MEMORY("Reading interrupt flags register = %X\n", ir->reg.flags);
+		return ir->reg.flags;
+	}
+
+	DEBUG_MEMORY("Reading interrupt enable register = %X\n", ir->reg.enable);
+	return ir->reg.enable;
+}
+
+static void interrupts_write(void* dev, uint16_t addr, uint8_t value) {
+	interrupts *ir = dev;
+
+	if (addr == 0xFF0F) {
+		DEBUG_INTERRUPTS("Setting interrupt flags to %X\n", value);
+		ir->reg.flags = value;
+	} else {
+		DEBUG_INTERRUPTS("Setting interrupt enable register to %X\n", value);
+		ir->reg.enable = value;
+	}
+}
+
 interrupts *interrupts_init(memory *mem) {
 	interrupts *ir = malloc(sizeof(interrupts));
 	if (ir == NULL)
@@ -13,7 +38,10 @@ interrupts *interrupts_init(memory *mem) {
 	ir->reg.enable = IRQ_NONE;
 	ir->reg.flags = IRQ_NONE;
 
+	ir->sch = mem->sch;
 	memory_set_interrupts(mem, ir);
+	memory_register_io(mem, 0xFF0F, interrupts_read, interrupts_write, ir);
+	memory_register_io(mem, 0xFFFF, interrupts_read, interrupts_write, ir);
 	return ir;
 }
 
@@ -22,38 +50,28 @@ void interrupts_end(interrupts *ir) {
 }
 
 void interrupts_process(interrupts *ir, state *st, memory* mem) {
-	if (st->irq_master && ir->reg.enable && ir->reg.flags) {
-		uint8_t cur_irq = ir->reg.enable & ir->reg.flags;
-
-		uint8_t handled_exception = (cur_irq & IRQ_VBLANK) ||
-			(cur_irq & IRQ_TIMER) ||
-			(cur_irq & IRQ_JOYPAD);
-
-		if (handled_exception) {
-
-			// Save pc on stack, disable interrupts
-			st->irq_master = 0;
-			st->reg.SP -= 2;
-			memory_write_word(mem, st->reg.SP, st->reg.PC);
-			st->clk += 3;
-
-
-			// Ack IRQ & jump to handler
-			if (cur_irq & IRQ_VBLANK) {
-				ir->reg.flags &= ~IRQ_VBLANK;
-				st->reg.PC = OFFSET_VBLANK;
-			} else if (cur_irq & IRQ_LCD) {
-				ir->reg.flags &= ~IRQ_LCD;
-				st->reg.PC = OFFSET_LCD;
-			} else if (cur_irq & IRQ_TIMER) {
-				ir->reg.flags &= ~IRQ_TIMER;
-				st->reg.PC = OFFSET_TIMER;
-			} else if (cur_irq & IRQ_JOYPAD) {
-				ir->reg.flags &= ~IRQ_JOYPAD;
-				st->reg.PC = OFFSET_JOYPAD;
-			}
-		}
-	}
+	uint8_t cur_irq = interrupts_pending(ir);
+	if (cur_irq == IRQ_NONE)
+		return;
+
+	// Any pending interrupt ends the halt mode, even when not served
+	st->halt_mode = 0;
+	if (!st->irq_master)
+		return;
+
+	// Save pc on stack, disable interrupts
+	st->irq_master = 0;
+	st->reg.SP -= 2;
+	memory_write_word(mem, st->reg.SP, st->reg.PC);
+	ir->sch->now += 5;
+
+	// Ack the highest priority IRQ & jump to its handler
+	uint8_t i = 0;
+	while ((cur_irq & (1 << i)) == 0)
+		i++;
+
+	ir->reg.flags &= ~(1 << i);
+	st->reg.PC = OFFSET_VBLANK + i * (OFFSET_LCD - OFFSET_VBLANK);
 }
 
 void interrupts_raise(interrupts *ir, IRQ_FLAGS num) {
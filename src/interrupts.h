@@ -20,13 +20,18 @@ typedef enum {
 	OFFSET_JOYPAD = 0x60
 } IRQ_OFFSETS;
 
+#define IRQ_ALL 0x1F
+
 typedef struct memory memory;
 typedef struct state state;
+typedef struct scheduler scheduler;
 typedef struct interrupts {
 	struct {
 		uint8_t flags;
 		uint8_t enable;
 	} reg;
+
+	scheduler *sch;
 } interrupts;
 
 interrupts *interrupts_init(memory *mem);
@@ -35,4 +40,9 @@ void interrupts_set_mmu(interrupts *ir);
 void interrupts_process(interrupts *ir, state *st, memory* mem);
 void interrupts_raise(interrupts *ir, IRQ_FLAGS num);
 
+// Enabled interrupts requested, whatever the master enable
+static inline uint8_t interrupts_pending(interrupts *ir) {
+	return ir->reg.enable & ir->reg.flags & IRQ_ALL;
+}
+
 #endif     // __INTERRUPTS_H__
@@ -1,11 +1,25 @@
 #include <stdlib.h>
-#include <SDL/SDL.h>
 #include "memory.h"
 #include "keyboard.h"
 #include "interrupts.h"
+#include "scheduler.h"
 #include "log.h"
 
-keyboard* keyboard_init(memory* mem) {
+static uint8_t keyboard_read(void* dev, uint16_t addr) {
+	keyboard *kb = dev;
+	uint8_t value = (kb->reg.active & FIRST_COL) ? kb->reg.joyp_first : kb->reg.joyp_second;
+	value = value & 0xF;
+	DEBUG_MEMORY("Reading keyboard register = %X\n", value);
+	return value;
+}
+
+static void keyboard_write(void* dev, uint16_t addr, uint8_t value) {
+	keyboard *kb = dev;
+	DEBUG_MEMORY("Setting keyboard register to %X\n", value);
+	kb->reg.active = value;
+}
+
+keyboard* keyboard_init(memory* mem, const keyboard_backend *backend) {
 	keyboard *kb = malloc(sizeof(keyboard));
 	if (kb == NULL)
 		ERROR("Unable to allocate memory for keyboard.\n");
@@ -15,6 +29,13 @@ keyboard* keyboard_init(memory* mem) {
 	kb->reg.joyp_second = SECOND_COL | 0xF;
 	kb->reg.active = 0x0;
 	mem->kb = kb;
+	memory_register_io(mem, 0xFF00, keyboard_read, keyboard_write, kb);
+
+	kb->backend = backend;
+	kb->ir = mem->ir;
+	kb->sch = mem->sch;
+	kb->ev = scheduler_add_event(kb->sch, keyboard_process, kb);
+	scheduler_schedule(kb->sch, kb->ev, kb->sch->now + KEYBOARD_POLL_CYCLES);
 	return kb;
 }
 
@@ -48,74 +69,14 @@ void keyboard_released(keyboard* kb, keyboard_key key, interrupts *ir) {
 	DEBUG_KEYBOARD("Key up %d -- %X - %X\n", key, kb->reg.joyp_first, kb->reg.joyp_second);
 }
 
-static keyboard_key sdl_to_key(SDLKey key) {
-	switch(key) {
-	case SDLK_a:
-		return KEY_A;
-	case SDLK_b:
-		return KEY_B;
-	case SDLK_l:
-		return KEY_SELECT;
-	case SDLK_s:
-		return KEY_START;
-	case SDLK_RIGHT:
-		return KEY_RIGHT;
-	case SDLK_LEFT:
-		return KEY_LEFT;
-	case SDLK_UP:
-		return KEY_UP;
-	case SDLK_DOWN:
-		return KEY_DOWN;
-	default:
-		return KEY_UNKNOWN;
-	}
-}
-
-void keyboard_process(keyboard *kb, interrupts *ir, uint16_t clk) {
-	SDL_Event event;
-	// TODO: maybe need multiple PollEvent later
-	while (SDL_PollEvent(&event)) {
-		switch(event.type)
-		{
-		case SDL_KEYDOWN:
-		{
-			keyboard_key key = sdl_to_key(event.key.keysym.sym);
-			if (key != KEY_UNKNOWN)
-				keyboard_pressed(kb, key, ir);
-			break;
-		}
-		case SDL_KEYUP:
-		{
-			keyboard_key key = sdl_to_key(event.key.keysym.sym);
-			if (key != KEY_UNKNOWN)
-				keyboard_released(kb, key, ir);
-			break;
+// Scheduler event, poll pending events
+void keyboard_process(void* dev, uint64_t now) {
+	keyboard *kb = dev;
 
-		}
-		}
-	}
+	scheduler_schedule(kb->sch, kb->ev, now + KEYBOARD_POLL_CYCLES);
+	kb->backend->poll(kb, kb->ir);
 }
 
 void keyboard_wait_key(keyboard *kb, interrupts *ir) {
-	SDL_Event event;
-	while (SDL_WaitEvent(&event)) {
-		switch(event.type)
-		{
-		case SDL_KEYDOWN:
-		{
-			keyboard_key key = sdl_to_key(event.key.keysym.sym);
-			if (key != KEY_UNKNOWN)
-				keyboard_pressed(kb, key, ir);
-			return;
-		}
-		case SDL_KEYUP:
-		{
-			keyboard_key key = sdl_to_key(event.key.keysym.sym);
-			if (key != KEY_UNKNOWN)
-				keyboard_released(kb, key, ir);
-			return;
-
-		}
-		}
-	}
+	kb->backend->wait(kb, ir);
 }
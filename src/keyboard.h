@@ -3,13 +3,36 @@
 
 #include <stdint.h>
 
-typedef struct keyboard {
+#define KEYBOARD_POLL_CYCLES 17556 // Once per frame
+
+typedef struct interrupts interrupts;
+typedef struct memory memory;
+typedef struct scheduler scheduler;
+typedef struct scheduler_event scheduler_event;
+typedef struct keyboard keyboard;
+
+// Input events source, keys are reported through keyboard_pressed and
+// keyboard_released
+typedef struct keyboard_backend {
+	void (*poll)(keyboard* kb, interrupts* ir); // Handle pending events
+	void (*wait)(keyboard* kb, interrupts* ir); // Block until a key event
+} keyboard_backend;
+
+extern const keyboard_backend keyboard_backend_sdl;
+extern const keyboard_backend keyboard_backend_headless;
+
+struct keyboard {
 	struct {
 		uint8_t joyp_first;
 		uint8_t joyp_second;
 		uint8_t active;
 	} reg;
-} keyboard;
+
+	interrupts *ir;
+	scheduler *sch;
+	scheduler_event *ev; // Next events polling
+	const keyboard_backend *backend;
+};
 
 typedef enum {
 	KEY_UNKNOWN = -1,
@@ -25,9 +48,9 @@ typedef enum {
 	KEY_DOWN    = SECOND_COL + (1 << 3),
 } keyboard_key;
 
-keyboard* keyboard_init(memory *mem);
+keyboard* keyboard_init(memory *mem, const keyboard_backend *backend);
 void keyboard_end(keyboard *kb);
-void keyboard_process(keyboard *kb, interrupts *ir, uint16_t clk);
+void keyboard_process(void* dev, uint64_t now);
 void keyboard_wait_key(keyboard *kb, interrupts *ir);
 void keyboard_pressed(keyboard* kb, keyboard_key key, interrupts *ir);
 void keyboard_released(keyboard* kb, keyboard_key key, interrupts *ir);
@@ -3,6 +3,16 @@
 #include <sys/mman.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* Prefaulting is only a hint */
+#ifndef MAP_POPULATE
+#define MAP_POPULATE 0
+#endif
 
 
 const uint8_t logo_official[0x30] =
@@ -36,6 +46,9 @@ GB* gbc_open(const char* filename)
 	// Init struct
 	rom->header = NULL;
 	rom->map = NULL;
+	rom->size = 0;
+	rom->map_size = 0;
+	rom->mapped = 0;
 
 	return rom;
 }
@@ -45,11 +58,10 @@ GB* gbc_open(const char* filename)
  **/
 void gbc_close(GB* rom)
 {
-	struct stat sb;
-	fstat(fileno(rom->stream), &sb);
-
-	if (rom->map != NULL)
-		munmap(rom->map, sb.st_size);
+	if (rom->map != NULL && rom->mapped)
+		munmap(rom->map, rom->map_size);
+	else
+		free(rom->map);
 
 	fclose(rom->stream);
 	free(rom->filename);
@@ -68,68 +80,75 @@ void gbc_read_header(GB *rom)
 	rom->header = malloc(sizeof(GB_Header));
 	CHECK_NULL(rom->header);
 
-	// Go to header
-	fseek(rom->stream, HEADER_START, SEEK_SET);
-
-	// Read header
-	if (fread(rom->header, sizeof(GB_Header), 1, rom->stream) != 1)
+	// Read header from the ROM in memory, the file may not be seekable
+	uint8_t *data = gbc_load_in_memory(rom);
+	if (rom->size < HEADER_START + sizeof(GB_Header))
 		FATAL_ERROR("Unable to read header information");
+
+	memcpy(rom->header, data + HEADER_START, sizeof(GB_Header));
 }
 
 /**
- * Check header content
+ * Sum of bytes, 16 at a time with SSE2
  **/
-void gbc_check_header(GB *rom)
+static uint32_t gbc_sum_bytes(const uint8_t *data, size_t size)
 {
-	uint8_t byte;
-	uint16_t checksum;
-	int i = 0;
+	uint32_t sum = 0;
+	size_t i = 0;
 
-	// First check : logo content
-	fseek(rom->stream, LOGO_START, SEEK_SET);
-	byte = fgetc(rom->stream);
-	while (!feof(rom->stream) && i < 0x30)
+#ifdef __SSE2__
+	// Each SAD adds 8 bytes in a 64 bits lane, two accumulators hide latency
+	__m128i zero = _mm_setzero_si128();
+	__m128i acc0 = zero, acc1 = zero;
+	for (; i + 32 <= size; i += 32)
 	{
-		// Check value
-		if (byte != logo_official[i])
-			FATAL_ERROR("Failed to check logo on octet %u (%X should be %X)", i, byte, logo_official[i]);
-		i++;
-		byte = fgetc(rom->stream);
+		acc0 = _mm_add_epi64(acc0, _mm_sad_epu8(_mm_loadu_si128((const __m128i *)(data + i)), zero));
+		acc1 = _mm_add_epi64(acc1, _mm_sad_epu8(_mm_loadu_si128((const __m128i *)(data + i + 16)), zero));
 	}
+	acc0 = _mm_add_epi64(acc0, acc1);
+	acc0 = _mm_add_epi64(acc0, _mm_unpackhi_epi64(acc0, acc0));
+	sum = _mm_cvtsi128_si32(acc0);
+#endif
 
-	// Check if we read whole logo
-	if (i != 0x30)
-		FATAL_ERROR("Logo seams to be shortened !");
+	for (; i < size; i++)
+		sum += data[i];
 
-	// Second : header checksum
-	byte = 0;
-	fseek(rom->stream, LOGO_START + 0x30, SEEK_SET);
+	return sum;
+}
 
-	for (i = LOGO_START + 0x30; i < HEADER_CHECKSUM_START; i++)
+/**
+ * Check header content, in a single pass over the ROM in memory
+ **/
+void gbc_check_header(GB *rom)
+{
+	const uint8_t *data = gbc_load_in_memory(rom);
+	uint8_t byte = 0;
+	uint16_t checksum = 0;
+	int i = 0;
+
+	if (rom->size < GLOBAL_CHECKSUM_START + 2)
+		FATAL_ERROR("Logo seams to be shortened !");
+
+	// Header, up to the global checksum: logo content then header checksum
+	for (i = 0; i < GLOBAL_CHECKSUM_START; i++)
 	{
-		byte = byte - fgetc(rom->stream) - 1;
+		if (i >= LOGO_START && i < LOGO_START + 0x30 && data[i] != logo_official[i - LOGO_START])
+			FATAL_ERROR("Failed to check logo on octet %u (%X should be %X)", i - LOGO_START, data[i], logo_official[i - LOGO_START]);
+
+		if (i >= LOGO_START + 0x30 && i < HEADER_CHECKSUM_START)
+			byte = byte - data[i] - 1;
+
+		checksum += data[i];
 	}
 
 	if (byte != rom->header->header_checksum)
 		FATAL_ERROR("Header checksum doesn't match (%X should be %X)", byte, rom->header->header_checksum);
 
-	// Third : Global Checksum
-	checksum = 0;
-	fseek(rom->stream, 0x0, SEEK_SET);
-	byte = fgetc(rom->stream);
-	i = 0;
-
-	while (!feof(rom->stream))
-	{
-		// Not the two checksum bytes
-		if (i != 0x14E && i != 0x14F)
-			checksum += byte;
-
-		byte = fgetc(rom->stream);
-	}
+	// Global checksum, all the bytes but its own two, stored big endian
+	checksum += gbc_sum_bytes(data + GLOBAL_CHECKSUM_START + 2, rom->size - GLOBAL_CHECKSUM_START - 2);
 
 	// Just warning because Gameboy doesn't really verify this checksum
-	if (checksum != rom->header->global_checksum)
+	if (checksum != ((data[GLOBAL_CHECKSUM_START] << 8) | data[GLOBAL_CHECKSUM_START + 1]))
 		WARNING("Global checksum doesn't match (not really a problem)");
 }
 
@@ -165,7 +184,112 @@ void gbc_print_header(GB *rom)
 }
 
 /**
- * Return a memory pointer for the file on memory
+ * Size of the ROM in memory, padded to whole banks and at least the two banks
+ * the cartridge address space shows
+ **/
+static size_t gbc_padded_size(size_t size)
+{
+	if (size < 2 * BANK_SIZE)
+		return 2 * BANK_SIZE;
+
+	return (size + BANK_SIZE - 1) / BANK_SIZE * BANK_SIZE;
+}
+
+/**
+ * Map a regular file read only. The pages are shared with the page cache and
+ * the other processes mapping the ROM, and prefaulted so that the first
+ * frames do not fault. Pages after the end of the file are zero filled.
+ **/
+static void *gbc_map_file(GB *rom, size_t size)
+{
+	size_t map_size = gbc_padded_size(size);
+	size_t align = map_size >= HUGE_PAGE_SIZE ? HUGE_PAGE_SIZE : 0;
+
+	// Reserve the padded size, aligned for huge pages
+	uint8_t *area = mmap(NULL, map_size + align, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (area == MAP_FAILED)
+		return NULL;
+
+	uint8_t *start = area;
+	if (align)
+	{
+		start = (uint8_t *)(((uintptr_t)area + align - 1) & ~(uintptr_t)(align - 1));
+		if (start > area)
+			munmap(area, start - area);
+		if (start + map_size < area + map_size + align)
+			munmap(start + map_size, area + map_size + align - (start + map_size));
+	}
+
+	// File pages over the reservation
+	if (mmap(start, size, PROT_READ, MAP_PRIVATE | MAP_FIXED | MAP_POPULATE, fileno(rom->stream), 0) == MAP_FAILED)
+	{
+		munmap(start, map_size);
+		return NULL;
+	}
+
+	madvise(start, size, MADV_WILLNEED);
+#ifdef MADV_HUGEPAGE
+	if (align)
+		madvise(start, size, MADV_HUGEPAGE);
+#endif
+
+	rom->size = size;
+	rom->map_size = map_size;
+	rom->mapped = 1;
+	return start;
+}
+
+/**
+ * Read a file which cannot be mapped (pipe, special file...) in an aligned
+ * buffer
+ **/
+static void *gbc_read_file(GB *rom)
+{
+	size_t capacity = 0, size = 0, read = 0;
+	uint8_t *buffer = NULL;
+
+	do
+	{
+		size += read;
+		if (size == capacity)
+		{
+			// Grow, an aligned buffer cannot be reallocated
+			uint8_t *grown = NULL;
+			capacity = capacity ? 2 * capacity : 16 * BANK_SIZE;
+			if (posix_memalign((void **)&grown, BUFFER_ALIGN, capacity) != 0)
+				FATAL_ERROR("Unable to allocate memory for ROM");
+			if (buffer != NULL)
+				memcpy(grown, buffer, size);
+			free(buffer);
+			buffer = grown;
+		}
+		read = fread(buffer + size, 1, capacity - size, rom->stream);
+	} while (read > 0);
+
+	if (ferror(rom->stream))
+		FATAL_ERROR("Unable to read file %s", rom->filename);
+
+	// Zero padded to whole banks
+	rom->size = size;
+	rom->map_size = gbc_padded_size(size);
+	if (rom->map_size > capacity)
+	{
+		uint8_t *grown = NULL;
+		if (posix_memalign((void **)&grown, BUFFER_ALIGN, rom->map_size) != 0)
+			FATAL_ERROR("Unable to allocate memory for ROM");
+		memcpy(grown, buffer, size);
+		free(buffer);
+		buffer = grown;
+	}
+	memset(buffer + size, 0, rom->map_size - size);
+
+	rom->mapped = 0;
+	return buffer;
+}
+
+/**
+ * Return a read only memory pointer for the file on memory, mapped when
+ * possible
  **/
 void *gbc_load_in_memory(GB *rom)
 {
@@ -173,8 +297,11 @@ void *gbc_load_in_memory(GB *rom)
 		return rom->map;
 
 	struct stat sb;
-	fstat(fileno(rom->stream), &sb);
+	if (fstat(fileno(rom->stream), &sb) == 0 && S_ISREG(sb.st_mode) && sb.st_size > 0)
+		rom->map = gbc_map_file(rom, sb.st_size);
+
+	if (rom->map == NULL)
+		rom->map = gbc_read_file(rom);
 
-	rom->map = mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(rom->stream), 0);
 	return rom->map;
 }
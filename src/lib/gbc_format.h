@@ -112,14 +112,21 @@ typedef struct
 	FILE* stream;
 	char* filename;
 	void *map;
+	size_t size;       /* Bytes read from the file */
+	size_t map_size;   /* Bytes of map, zero padded to whole banks */
+	int mapped;        /* map is a file mapping, else an allocated buffer */
 
 	/* GB/GBC Oriented */
 	GB_Header* header;
 } GB;
 
 #define HEADER_START          0x100
+#define BANK_SIZE             0x4000
+#define BUFFER_ALIGN          0x1000   /* Alignment of a ROM read in memory */
+#define HUGE_PAGE_SIZE        0x200000 /* ROMs this large are mapped for huge pages */
 #define LOGO_START            0x104
 #define HEADER_CHECKSUM_START 0x14D
+#define GLOBAL_CHECKSUM_START 0x14E
 
 
 /** Managing open/close of GB file **/
@@ -143,6 +150,6 @@ void gbc_check_header(GB* rom);
 /* Print header content */
 void gbc_print_header(GB *rom);
 
-/* Return a memory pointer for the file on memory */
+/* Return a read only memory pointer for the file on memory */
 void *gbc_load_in_memory(GB *rom);
 #endif // __GBC_FORMAT_H__
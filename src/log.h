@@ -16,6 +16,7 @@ extern int activate_debug;
 #define NDEBUG_KEYBOARD
 #define NDEBUG_TIMER
 #define NDEBUG_INTERRUPTS
+#define NDEBUG_DBT
 #endif
 
 #ifndef NDEBUG_OPCODES
@@ -55,4 +56,10 @@ extern int activate_debug;
 #define DEBUG_INTERRUPTS(format, ...)
 #endif
 
+#ifndef NDEBUG_DBT
+#define DEBUG_DBT(format, ...) do { if (activate_debug) { fprintf(stdout, format, ##__VA_ARGS__); fflush(stdout); } } while (0)
+#else
+#define DEBUG_DBT(format, ...)
+#endif
+
 #endif     // __ERROR_H__
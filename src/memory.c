@@ -1,10 +1,18 @@
 #include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
 #include "log.h"
 #include "memory.h"
 #include "gpu.h"
 #include "keyboard.h"
 #include "interrupts.h"
 #include "timer.h"
+#include "dbt.h"
+#include "scheduler.h"
+#include "pacer.h"
 
 static uint8_t standard_bios[] = {
 	0x31, 0xFE, 0xFF, 0xAF, 0x21, 0xFF, 0x9F, 0x32, 0xCB, 0x7C, 0x20, 0xFB, 0x21, 0x26, 0xFF, 0x0E,
@@ -25,8 +33,502 @@ static uint8_t standard_bios[] = {
 	0xF5, 0x06, 0x19, 0x78, 0x86, 0x23, 0x05, 0x20, 0xFB, 0x86, 0x20, 0xFE, 0x3E, 0x01, 0xE0, 0x50
 };
 
+// Direct access pointers of a page, left NULL when accesses have side effects
+void memory_map_page(memory* mem, uint8_t page) {
+	uint32_t addr = page << 8;
+	uint8_t* rd = NULL;
+	uint8_t* wr = NULL;
+
+	switch (page >> 4) {
+		// Cartridge ROM, bank 0
+	case 0x0:
+		if (page == 0 && mem->in_bios)
+			rd = mem->bios;
+		else
+			rd = mem->rom + addr;
+		break;
+	case 0x1:
+	case 0x2:
+	case 0x3:
+		rd = mem->rom + addr;
+		break;
+
+		// Cartridge ROM, other banks
+	case 0x4:
+	case 0x5:
+	case 0x6:
+	case 0x7:
+		rd = mem->rom_bank_base + addr;
+		break;
+
+		// Graphics RAM, tile data writes update the decoded tiles
+	case 0x8:
+	case 0x9:
+		if (mem->gpu != NULL) {
+			rd = mem->gpu - 0x8000 + addr;
+			if (addr >= 0x9800)
+				wr = rd;
+		}
+		break;
+
+		// Cartridge (External) RAM, current bank. MBC2 RAM half bytes are
+		// masked by the slow path.
+	case 0xA:
+	case 0xB:
+		if (mem->mbc == MEMORY_MBC2)
+			break;
+
+		if (mem->ram_bank_base != NULL && mem->ram_cur_offset + addr - 0xA000 + 0x100 <= mem->ram_size) {
+			rd = mem->ram_bank_base + addr;
+			if (mem->mbc != MEMORY_MBC_NONE && (mem->ram_dirty || !mem->battery))
+				wr = rd;
+		}
+		break;
+
+		// Working RAM
+	case 0xC:
+	case 0xD:
+		rd = wr = mem->working - 0xC000 + addr;
+		break;
+
+		// Working RAM (shadow), sprites & I/O are left to the slow path
+	case 0xE:
+	case 0xF:
+		if (page < 0xFE)
+			rd = wr = mem->working - 0xE000 + addr;
+		break;
+	}
+
+	// Writes on translated code must be caught
+	if (mem->tr != NULL && mem->tr->code_pages[page])
+		wr = NULL;
+
+	// The slow path blocks accesses during OAM DMA
+	if (mem->dma_active)
+		rd = wr = NULL;
+
+	mem->read_pages[page] = rd;
+	mem->write_pages[page] = wr;
+}
+
+static void memory_map_pages(memory* mem, uint8_t first, uint8_t last) {
+	uint32_t page = 0;
+	for (page = first; page <= last; page++)
+		memory_map_page(mem, page);
+}
+
+// Select the ROM bank mapped at 0x4000-0x7FFF. Only the region base pointer
+// and its page table entries change, nothing when the bank is the same.
+static void memory_switch_rom_bank(memory* mem, uint16_t bank) {
+	uint32_t offset = (bank % (mem->rom_size / MEMORY_ROM_BANK_SIZE)) * MEMORY_ROM_BANK_SIZE;
+	uint32_t page = 0;
+
+	if (offset == mem->mbc_cur_offset)
+		return;
+
+	// ROM pages are never written directly, nor read during OAM DMA
+	mem->mbc_cur_offset = offset;
+	mem->rom_bank_base = mem->rom + offset - 0x4000;
+	if (!mem->dma_active)
+		for (page = 0x40; page < 0x80; page++)
+			mem->read_pages[page] = mem->rom_bank_base + (page << 8);
+
+	if (mem->tr != NULL)
+		dbt_remap(mem->tr);
+}
+
+// Select the external RAM bank mapped at 0xA000-0xBFFF, or none when the MBC3
+// clock registers are selected
+static void memory_switch_ram_bank(memory* mem, uint8_t bank) {
+	uint8_t* base = NULL;
+	uint32_t banks = mem->ram_size > MEMORY_RAM_BANK_SIZE ? mem->ram_size / MEMORY_RAM_BANK_SIZE : 1;
+
+	if (mem->ram_size != 0 && !(mem->mbc == MEMORY_MBC3 && bank >= MEMORY_RTC_SECONDS)) {
+		mem->ram_cur_offset = (bank % banks) * MEMORY_RAM_BANK_SIZE;
+		base = mem->external + mem->ram_cur_offset - 0xA000;
+	}
+
+	if (base == mem->ram_bank_base)
+		return;
+
+	mem->ram_bank_base = base;
+	memory_map_pages(mem, 0xA0, 0xBF);
+	if (mem->tr != NULL)
+		dbt_invalidate_range(mem->tr, 0xA000, 0xC000);
+}
+
+static inline uint8_t memory_rtc_selected(memory* mem) {
+	return mem->mbc == MEMORY_MBC3 && mem->ram_bank >= MEMORY_RTC_SECONDS;
+}
+
+static void memory_rtc_set(memory* mem, uint64_t seconds) {
+	if (mem->rtc.halt)
+		mem->rtc.seconds = seconds;
+	else
+		mem->rtc.base = mem->sch->now - seconds * PACER_CPU_FREQUENCY;
+}
+
+// Clock counter in seconds, wrapping after MEMORY_RTC_DAYS with the carry set
+static uint64_t memory_rtc_counter(memory* mem) {
+	memory_rtc* rtc = &(mem->rtc);
+	uint64_t seconds = rtc->halt ? rtc->seconds : (mem->sch->now - rtc->base) / PACER_CPU_FREQUENCY;
+
+	if (seconds >= MEMORY_RTC_DAYS * 86400ULL) {
+		seconds %= MEMORY_RTC_DAYS * 86400ULL;
+		rtc->carry = 1;
+		memory_rtc_set(mem, seconds);
+	}
+
+	return seconds;
+}
+
+// Clock registers of a counter value
+static void memory_rtc_split(memory* mem, uint64_t seconds, uint8_t* regs) {
+	uint16_t days = seconds / 86400;
+
+	regs[0] = seconds % 60;
+	regs[1] = (seconds / 60) % 60;
+	regs[2] = (seconds / 3600) % 24;
+	regs[3] = days & 0xFF;
+	regs[4] = ((days >> 8) & 0x1) | (mem->rtc.halt << 6) | (mem->rtc.carry << 7);
+}
+
+static void memory_rtc_latch(memory* mem) {
+	memory_rtc_split(mem, memory_rtc_counter(mem), mem->rtc.regs);
+}
+
+// Store the clock in the save file, with the host time to catch up from
+static void memory_rtc_store(memory* mem) {
+	memory_rtc_save* save = mem->rtc_save;
+	uint8_t regs[5];
+	uint8_t i = 0;
+
+	memory_rtc_split(mem, memory_rtc_counter(mem), regs);
+	for (i = 0; i < 5; i++) {
+		save->current[i] = regs[i];
+		save->latched[i] = mem->rtc.regs[i];
+	}
+	save->timestamp = time(NULL);
+}
+
+// Restore the clock from the save file, it kept running while the emulator
+// was closed. A new save has no timestamp, the clock starts from zero.
+static void memory_rtc_load(memory* mem) {
+	memory_rtc_save* save = mem->rtc_save;
+	memory_rtc* rtc = &(mem->rtc);
+	uint64_t host = time(NULL);
+	uint8_t i = 0;
+
+	if (save->timestamp == 0)
+		return;
+
+	uint64_t days = (save->current[3] & 0xFF) | ((save->current[4] & 0x1) << 8);
+	uint64_t seconds = ((days * 24 + save->current[2] % 24) * 60 + save->current[1] % 60) * 60 + save->current[0] % 60;
+	rtc->halt = (save->current[4] >> 6) & 0x1;
+	rtc->carry = (save->current[4] >> 7) & 0x1;
+	for (i = 0; i < 5; i++)
+		rtc->regs[i] = save->latched[i];
+
+	if (!rtc->halt && host > save->timestamp)
+		seconds += host - save->timestamp;
+	memory_rtc_set(mem, seconds);
+}
+
+// Clock registers are read latched
+static uint8_t memory_rtc_read(memory* mem) {
+	uint8_t reg = mem->ram_bank - MEMORY_RTC_SECONDS;
+	if (reg >= sizeof(mem->rtc.regs))
+		return 0xFF;
+
+	return mem->rtc.regs[reg];
+}
+
+// A write changes a field of the running counter
+static void memory_rtc_write(memory* mem, uint8_t value) {
+	memory_rtc* rtc = &(mem->rtc);
+	uint8_t reg = mem->ram_bank - MEMORY_RTC_SECONDS;
+	uint64_t seconds = memory_rtc_counter(mem);
+	uint64_t sec = seconds % 60, min = (seconds / 60) % 60, hour = (seconds / 3600) % 24, days = seconds / 86400;
+
+	switch (reg) {
+	case 0:
+		sec = value % 60;
+		break;
+	case 1:
+		min = value % 60;
+		break;
+	case 2:
+		hour = value % 24;
+		break;
+	case 3:
+		days = (days & 0x100) | value;
+		break;
+	case 4:
+		days = (days & 0xFF) | ((value & 0x1) << 8);
+		rtc->carry = (value >> 7) & 0x1;
+		rtc->halt = (value >> 6) & 0x1;
+		break;
+	default:
+		return;
+	}
+
+	rtc->regs[reg] = value;
+	memory_rtc_set(mem, ((days * 24 + hour) * 60 + min) * 60 + sec);
+}
+
+// MBC1, the 2 bits register completes the ROM bank, and selects the RAM bank
+// in RAM banking mode
+static void memory_mbc1_write(memory* mem, uint16_t addr, uint8_t value) {
+	switch (addr >> 13) {
+	case 0x0:
+		mem->ram_on = ((value & 0x0F) == 0x0A);
+		return;
+	case 0x1:
+		mem->rom_bank = (value & 0x1F) ? (value & 0x1F) : 1;
+		break;
+	case 0x2:
+		mem->ram_bank = value & 0x3;
+		break;
+	case 0x3:
+		mem->rom_ram_mode = value & 0x1;
+		break;
+	}
+
+	memory_switch_rom_bank(mem, mem->rom_bank | (mem->ram_bank << 5));
+	memory_switch_ram_bank(mem, mem->rom_ram_mode ? mem->ram_bank : 0);
+}
+
+// MBC2, address bit 8 selects between RAM enable and ROM bank
+static void memory_mbc2_write(memory* mem, uint16_t addr, uint8_t value) {
+	if (addr >= 0x4000)
+		return;
+
+	if (addr & 0x100) {
+		mem->rom_bank = (value & 0x0F) ? (value & 0x0F) : 1;
+		memory_switch_rom_bank(mem, mem->rom_bank);
+	} else {
+		mem->ram_on = ((value & 0x0F) == 0x0A);
+	}
+}
+
+// MBC3, RAM banks 0x08-0x0C are the clock registers, latched by writing 0
+// then 1
+static void memory_mbc3_write(memory* mem, uint16_t addr, uint8_t value) {
+	switch (addr >> 13) {
+	case 0x0:
+		mem->ram_on = ((value & 0x0F) == 0x0A);
+		break;
+	case 0x1:
+		mem->rom_bank = (value & 0x7F) ? (value & 0x7F) : 1;
+		memory_switch_rom_bank(mem, mem->rom_bank);
+		break;
+	case 0x2:
+		mem->ram_bank = value;
+		memory_switch_ram_bank(mem, value);
+		break;
+	case 0x3:
+		if (mem->rtc.latch == 0 && value == 1)
+			memory_rtc_latch(mem);
+		mem->rtc.latch = value;
+		break;
+	}
+}
+
+// MBC5, 9 bits ROM bank where bank 0 can be selected, up to 16 RAM banks
+static void memory_mbc5_write(memory* mem, uint16_t addr, uint8_t value) {
+	switch (addr >> 12) {
+	case 0x0:
+	case 0x1:
+		mem->ram_on = ((value & 0x0F) == 0x0A);
+		break;
+	case 0x2:
+		mem->rom_bank = (mem->rom_bank & 0x100) | value;
+		memory_switch_rom_bank(mem, mem->rom_bank);
+		break;
+	case 0x3:
+		mem->rom_bank = (mem->rom_bank & 0xFF) | ((value & 0x1) << 8);
+		memory_switch_rom_bank(mem, mem->rom_bank);
+		break;
+	case 0x4:
+	case 0x5:
+		// Bit 3 drives the rumble motor instead on rumble cartridges
+		if (mem->mbc_mode >= MBC5_RUMBLE)
+			value &= 0x07;
+		mem->ram_bank = value & 0x0F;
+		memory_switch_ram_bank(mem, mem->ram_bank);
+		break;
+	}
+}
+
+// Battery backed RAM is kept in <rom name>.sav, mapped shared so that
+// writes reach the file without any copy. Returns 0 when the save file is not
+// usable, the game is then played without saving.
+static uint8_t memory_open_save(memory* mem, GB* rom) {
+	char path[4096];
+	snprintf(path, sizeof(path), "%s", rom->filename);
+	char *ext = strrchr(path, '.');
+	if (ext == NULL || strchr(ext, '/') != NULL)
+		ext = path + strlen(path);
+	snprintf(ext, sizeof(path) - (ext - path), ".sav");
+
+	int fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0) {
+		WARN("Unable to open save file %s, the game will not be saved.\n", path);
+		return 0;
+	}
+
+	// A new save is zero filled, a longer one is kept whole
+	off_t size = lseek(fd, 0, SEEK_END);
+	if (size < mem->save_size && ftruncate(fd, mem->save_size) != 0) {
+		WARN("Unable to resize save file %s, the game will not be saved.\n", path);
+		close(fd);
+		return 0;
+	}
+
+	uint8_t* save = mmap(NULL, mem->save_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (save == MAP_FAILED) {
+		WARN("Unable to map save file %s, the game will not be saved.\n", path);
+		return 0;
+	}
+
+	// The clock follows the RAM
+	mem->external = save;
+	if (mem->save_size > mem->ram_size)
+		mem->rtc_save = (memory_rtc_save*)(mem->external + mem->ram_size);
+	return 1;
+}
+
+// Scheduler event, start writing the RAM changed since the last sync back to
+// the save file and catch the next write again
+static void memory_save_process(void* dev, uint64_t now) {
+	memory* mem = dev;
+	scheduler_schedule(mem->sch, mem->save_ev, now + MEMORY_SAVE_PERIOD);
+
+	// The clock always changes, the RAM only once written
+	if (mem->rtc_save != NULL)
+		memory_rtc_store(mem);
+	else if (!mem->ram_dirty)
+		return;
+
+	msync(mem->external, mem->save_size, MS_ASYNC);
+	mem->ram_dirty = 0;
+	memory_map_pages(mem, 0xA0, 0xBF);
+}
+
+// During OAM DMA the CPU only reaches I/O registers and HRAM, which are not
+// on the buses used by the transfer. Other reads give 0xFF.
+static inline uint8_t memory_dma_blocks(memory* mem, uint16_t addr) {
+	return mem->dma_active && addr < 0xFF00;
+}
+
+// OAM DMA, the 160 bytes are copied at once from the source page, then the
+// bus stays blocked for the duration of the transfer
+static void memory_dma_transfert(memory *mem, uint8_t page) {
+	uint16_t i = 0;
+
+	// Above working RAM, the source is its shadow
+	if (page >= 0xE0)
+		page -= 0x20;
+
+	// The transfer reads its source past the bus block, a running one is
+	// restarted
+	mem->dma_active = 0;
+	memory_map_page(mem, page);
+
+	uint8_t* src = mem->read_pages[page];
+	if (src != NULL) {
+		memcpy(mem->oam, src, MEMORY_DMA_LENGTH);
+	} else {
+		for (i = 0; i < MEMORY_DMA_LENGTH; i++)
+			mem->oam[i] = memory_read_byte_slow(mem, (page << 8) + i);
+	}
+
+	mem->dma_active = 1;
+	memory_map_pages(mem, 0x00, 0xFF);
+	if (mem->tr != NULL)
+		dbt_remap(mem->tr);
+	scheduler_schedule(mem->sch, mem->dma_ev, mem->sch->now + MEMORY_DMA_CYCLES);
+}
+
+// Scheduler event at the end of OAM DMA, the bus is free again
+static void memory_dma_process(void* dev, uint64_t now) {
+	memory* mem = dev;
+	mem->dma_active = 0;
+	memory_map_pages(mem, 0x00, 0xFF);
+}
+
+// Index of an I/O register in the dispatch table
+static inline uint8_t memory_io_index(uint16_t addr) {
+	return addr == 0xFFFF ? MEMORY_IO_ENABLE : addr - 0xFF00;
+}
+
+void memory_register_io(memory* mem, uint16_t addr, memory_io_reader read, memory_io_writer write, void* dev) {
+	if ((addr < 0xFF00 || addr >= 0xFF80) && addr != 0xFFFF)
+		ERROR("Registering I/O handler outside I/O region at %X\n", addr);
+
+	memory_io* io = &(mem->io[memory_io_index(addr)]);
+	io->read = read;
+	io->write = write;
+	io->dev = dev;
+}
+
+// Registers are accessed once pending events ran
+static uint8_t memory_io_read(memory* mem, uint16_t addr) {
+	memory_io* io = &(mem->io[memory_io_index(addr)]);
+	scheduler_sync(mem->sch);
+	mem->io_access = 1;
+
+	if (io->read == NULL) {
+		WARN("Reading I/O still not handled for 0x%X.\n", addr);
+		return 0;
+	}
+
+	return io->read(io->dev, addr);
+}
+
+static void memory_io_write(memory* mem, uint16_t addr, uint8_t value) {
+	memory_io* io = &(mem->io[memory_io_index(addr)]);
+	scheduler_sync(mem->sch);
+	mem->io_access = 1;
+
+	if (io->write == NULL) {
+		WARN("Writing I/O still not handled for 0x%X.\n", addr);
+		return;
+	}
+
+	io->write(io->dev, addr, value);
+}
+
+// DMA transfert
+static void memory_dma_write(void* dev, uint16_t addr, uint8_t value) {
+	DEBUG_MEMORY("Starting DMA transfert for %X\n", value);
+	memory_dma_transfert(dev, value);
+}
+
+// Bios mode
+static uint8_t memory_bios_read(void* dev, uint16_t addr) {
+	memory* mem = dev;
+	DEBUG_MEMORY("Reading in_bios = %X\n", mem->in_bios);
+	return mem->in_bios;
+}
+
+static void memory_bios_write(void* dev, uint16_t addr, uint8_t value) {
+	memory* mem = dev;
+	if (!mem->in_bios) {
+		WARN("Writing I/O still not handled for 0x%X.\n", addr);
+		return;
+	}
+
+	DEBUG_MEMORY("Setting in_bios to %X\n", !value);
+	mem->in_bios = !value;
+	memory_map_page(mem, 0x00);
+	if (mem->tr != NULL)
+		dbt_remap(mem->tr);
+}
+
 memory* memory_init(GB* rom) {
-	memory* mem = malloc(sizeof(memory));
+	memory* mem = calloc(1, sizeof(memory));
 	if (mem == NULL)
 		ERROR("Unable to allocate memory for memory structure.\n");
 
@@ -38,21 +540,59 @@ memory* memory_init(GB* rom) {
 		ERROR("Unable to load ROM into memory.\n");
 
 	mem->mbc_mode = rom->header->type;
-	mem->mbc_cur_offset = 0x0;
-	mem->ram_cur_offset = 0x0;
 	mem->ram_on = 0;
 	mem->rom_ram_mode = 0;
+	mem->tr = NULL;
 
 	switch (mem->mbc_mode) {
 	case ROM_ONLY:
+		mem->mbc = MEMORY_MBC_NONE;
+		break;
 	case MBC1:
 	case MBC1_RAM:
+	case MBC1_RAM_BATTERY:
+		mem->mbc = MEMORY_MBC1;
+		break;
 	case MBC2:
+	case MBC2_BATTERY:
+		mem->mbc = MEMORY_MBC2;
+		break;
+	case MBC3_TIMER_BATTERY:
+	case MBC3_TIMER_RAM_BATTERY:
+	case MBC3:
+	case MBC3_RAM:
+	case MBC3_RAM_BATTERY:
+		mem->mbc = MEMORY_MBC3;
+		break;
+	case MBC5:
+	case MBC5_RAM:
+	case MBC5_RAM_BATTERY:
+	case MBC5_RUMBLE:
+	case MBC5_RUMBLE_RAM:
+	case MBC5_RUMBLE_RAM_BATTERY:
+		mem->mbc = MEMORY_MBC5;
 		break;
 	default:
 		ERROR("Not supported memory bank type %X\n", mem->mbc_mode);
 	}
 
+	switch (rom->header->rom_size) {
+	case S1_1MByte:
+		mem->rom_size = 72 * MEMORY_ROM_BANK_SIZE;
+		break;
+	case S1_2MByte:
+		mem->rom_size = 80 * MEMORY_ROM_BANK_SIZE;
+		break;
+	case S1_5MByte:
+		mem->rom_size = 96 * MEMORY_ROM_BANK_SIZE;
+		break;
+	default:
+		// Up to 8 MB
+		if (rom->header->rom_size > S4MByte + 1)
+			ERROR("Unsupported rom size %X\n", rom->header->rom_size);
+		mem->rom_size = 2 * MEMORY_ROM_BANK_SIZE << rom->header->rom_size;
+	}
+
 	switch(rom->header->ram_size) {
 	case 0x0:
 		mem->ram_size = 0;
@@ -64,10 +604,53 @@ memory* memory_init(GB* rom) {
 		mem->ram_size = 8192;
 		break;
 	case 0x3:
+		mem->ram_size = 4 * MEMORY_RAM_BANK_SIZE;
+		break;
+	case 0x4:
+		mem->ram_size = 16 * MEMORY_RAM_BANK_SIZE;
+		break;
+	case 0x5:
+		mem->ram_size = 8 * MEMORY_RAM_BANK_SIZE;
+		break;
+	default:
 		ERROR("Unsupported ram size %X\n", rom->header->ram_size);
 	}
 
-	if (mem->ram_size) {
+	// Banks missing from the file are not mapped
+	if (mem->rom_size > rom->map_size)
+		mem->rom_size = rom->map_size;
+
+	// MBC2 has its own 512 x 4 bits RAM
+	if (mem->mbc == MEMORY_MBC2)
+		mem->ram_size = MEMORY_MBC2_RAM_SIZE;
+
+	// The clock is saved after the RAM
+	mem->save_size = mem->ram_size;
+	switch (mem->mbc_mode) {
+	case MBC3_TIMER_BATTERY:
+	case MBC3_TIMER_RAM_BATTERY:
+		mem->save_size += sizeof(memory_rtc_save);
+		mem->battery = 1;
+		break;
+	case MBC1_RAM_BATTERY:
+	case MBC2_BATTERY:
+	case MBC3_RAM_BATTERY:
+	case MBC5_RAM_BATTERY:
+	case MBC5_RUMBLE_RAM_BATTERY:
+		mem->battery = mem->ram_size != 0;
+		break;
+	default:
+		mem->battery = 0;
+	}
+
+	mem->ram_dirty = 0;
+	mem->rtc_save = NULL;
+	mem->save_ev = NULL;
+	// Without save file, the RAM is lost on exit
+	if (mem->battery && !memory_open_save(mem, rom))
+		mem->battery = 0;
+
+	if (!mem->battery && mem->ram_size) {
 		mem->external = calloc(mem->ram_size, sizeof(uint8_t));
 		if (mem->external == NULL)
 			ERROR("Unable to allocate memory for external RAM.\n");
@@ -81,11 +664,32 @@ memory* memory_init(GB* rom) {
 	if (mem->zero == NULL)
 		ERROR("Unable to allocate memory for Zero page.\n");
 
+	// Bank 1 & RAM bank 0 at power on
+	mem->rom_bank = 1;
+	mem->ram_bank = 0;
+	mem->mbc_cur_offset = MEMORY_ROM_BANK_SIZE;
+	mem->rom_bank_base = mem->rom;
+	mem->ram_cur_offset = 0;
+	mem->ram_bank_base = mem->ram_size ? mem->external - 0xA000 : NULL;
+
+	memory_register_io(mem, 0xFF46, NULL, memory_dma_write, mem);
+	memory_register_io(mem, 0xFF50, memory_bios_read, memory_bios_write, mem);
+
+	memory_map_pages(mem, 0x00, 0xFF);
 	return mem;
 }
 
 void memory_end(memory *mem) {
-	free(mem->external);
+	// Saves are complete on exit
+	if (mem->battery) {
+		if (mem->rtc_save != NULL)
+			memory_rtc_store(mem);
+		msync(mem->external, mem->save_size, MS_SYNC);
+		munmap(mem->external, mem->save_size);
+	} else {
+		free(mem->external);
+	}
+
 	free(mem->working);
 	free(mem->zero);
 	free(mem);
@@ -93,12 +697,14 @@ void memory_end(memory *mem) {
 
 void memory_set_bios(memory* mem, uint8_t status) {
 	mem->in_bios = status;
+	memory_map_page(mem, 0x00);
 }
 
 void memory_set_gpu(memory* mem, gpu *gp) {
 	mem->gpu = gp->vram;
 	mem->oam = gp->oam;
 	mem->gp = gp;
+	memory_map_pages(mem, 0x80, 0x9F);
 }
 
 void memory_set_interrupts(memory* mem, interrupts* ir) {
@@ -109,25 +715,48 @@ void memory_set_timer(memory* mem, timer* t) {
 	mem->t = t;
 }
 
-static void memory_dma_transfert(memory *mem, uint16_t from, uint16_t to, uint16_t length) {
-	length += from;
-	for (; from < length; from++, to++)
-		memory_write_byte(mem, to, memory_read_byte(mem, from));
+void memory_set_scheduler(memory* mem, scheduler* sch) {
+	mem->sch = sch;
+	mem->dma_ev = scheduler_add_event(sch, memory_dma_process, mem);
+
+	if (mem->rtc_save != NULL)
+		memory_rtc_load(mem);
+
+	if (mem->battery) {
+		mem->save_ev = scheduler_add_event(sch, memory_save_process, mem);
+		scheduler_schedule(sch, mem->save_ev, sch->now + MEMORY_SAVE_PERIOD);
+	}
+}
+
+void memory_set_dbt(memory* mem, dbt* tr) {
+	mem->tr = tr;
+	memory_map_pages(mem, 0x00, 0xFF);
 }
 
 static void* memory_read_byte_membank(memory* mem, uint16_t addr) {
 	if (addr >= 0x4000 && addr < 0x8000)
-		return mem->rom + mem->mbc_cur_offset;
+		return mem->rom_bank_base;
 
 	if (addr >= 0xA000 && addr < 0xC000)
-		return mem->external - 0xA000 + mem->ram_cur_offset;
+		return mem->ram_bank_base;
 
 	return NULL;
 }
 
-uint8_t memory_read_byte(memory* mem, uint16_t addr) {
+// Offset in the ROM file of a cartridge ROM address (0x0000-0x7FFF)
+uint32_t memory_rom_offset(memory* mem, uint16_t addr) {
+	if (addr >= 0x4000)
+		return mem->mbc_cur_offset + addr - 0x4000;
 
+	return addr;
+}
+
+// Accesses not served by the page table
+uint8_t memory_read_byte_slow(memory* mem, uint16_t addr) {
 	void* offset = NULL;
+
+	if (memory_dma_blocks(mem, addr))
+		return 0xFF;
 	switch ((addr & 0xF000) >> 12) {
 		// Cartridge ROM, bank 0
 	case 0x0:
@@ -160,10 +789,17 @@ uint8_t memory_read_byte(memory* mem, uint16_t addr) {
 		// Cartridge (External) RAM
 	case 0xA:
 	case 0xB:
+		if (memory_rtc_selected(mem))
+			return memory_rtc_read(mem);
+
+		// MBC2 RAM is repeated over the region, its upper half bytes read 1
+		if (mem->mbc == MEMORY_MBC2)
+			return 0xF0 | mem->external[addr & (MEMORY_MBC2_RAM_SIZE - 1)];
+
 		if (mem->ram_size == 0)
 			ERROR("Reading external ram but none present.\n");
 
-		if (addr - 0xA000 > mem->ram_size)
+		if (mem->ram_cur_offset + addr - 0xA000 >= mem->ram_size)
 			ERROR("Reading outside external ram.\n");
 
 		offset = memory_read_byte_membank(mem, addr);
@@ -198,104 +834,13 @@ uint8_t memory_read_byte(memory* mem, uint16_t addr) {
 		}
 
 		// Zero page
-		if (addr >= 0xFF80) {
+		if (addr >= 0xFF80 && addr != 0xFFFF) {
 			offset = mem->zero - 0xFF80;
 			break;
 		}
 
-		// Timer register
-
-		// Timer divider
-		if (addr == 0xFF04) {
-			DEBUG_MEMORY("Reading Timer Divider register = %X\n", mem->t->reg.divider);
-			return mem->t->reg.divider;
-		}
-
-		// Timer counter
-		if (addr == 0xFF05) {
-			DEBUG_MEMORY("Reading Timer Counter register = %X\n", mem->t->reg.counter);
-			return mem->t->reg.counter;
-		}
-
-		// Timer modulo
-		if (addr == 0xFF06) {
-			DEBUG_MEMORY("Reading Timer Modulo register = %X\n", mem->t->reg.modulo);
-			return mem->t->reg.modulo;
-		}
-
-		// Timer control
-		if (addr == 0xFF07) {
-			DEBUG_MEMORY("Reading Timer Control register = %X\n", mem->t->reg.control);
-			return mem->t->reg.control;
-		}
-
-		// GPU registers
-
-		// LCD control
-		if (addr == 0xFF40) {
-			DEBUG_MEMORY("Reading LCD control  = %X\n", mem->gp->reg.control);
-			return mem->gp->reg.control;
-		}
-
-		// LCD Status
-		if (addr == 0xFF41) {
-			DEBUG_MEMORY("Reading LCD status  = %X\n", mem->gp->reg.status);
-			return mem->gp->reg.status;
-		}
-
-		// Scroll Y
-		if (addr == 0xFF42) {
-			DEBUG_MEMORY("Reading GPU scroll_y = %X\n", mem->gp->reg.scroll_y);
-			return mem->gp->reg.scroll_y;
-		}
-
-		// Scroll X
-		if (addr == 0xFF43) {
-			DEBUG_MEMORY("Reading GPU scroll_x = %X\n", mem->gp->reg.scroll_x);
-			return mem->gp->reg.scroll_x;
-		}
-
-		// Scan line
-		if (addr == 0xFF44) {
-			DEBUG_MEMORY("Reading GPU scanline  = %X\n", mem->gp->reg.cur_line);
-			return mem->gp->reg.cur_line;
-		}
-
-		// Check Scan line
-		if (addr == 0xFF45) {
-			DEBUG_MEMORY("Reading GPU check scanline  = %X\n", mem->gp->reg.check_line);
-			return mem->gp->reg.check_line;
-		}
-
-		// Bios mode
-		if (addr == 0xFF50) {
-			DEBUG_MEMORY("Reading in_bios = %X\n", mem->in_bios);
-			return mem->in_bios;
-		}
-
-		// Keyboard Register
-		if (addr == 0xFF00) {
-			uint8_t value = (mem->kb->reg.active & FIRST_COL) ? mem->kb->reg.joyp_first : mem->kb->reg.joyp_second;
-			value = value & 0xF;
-			DEBUG_MEMORY("Reading keyboard register = %X\n", value);
-			return value;
-		}
-
-		// Interrupt flags
-		if (addr == 0xFF0F) {
-			DEBUG_MEMORY("Reading interrupt flags register = %X\n", mem->ir->reg.flags);
-			return mem->ir->reg.flags;
-		}
-
-		// Interrupt enable
-		if (addr == 0xFFFF) {
-			DEBUG_MEMORY("Reading interrupt enable register = %X\n", mem->ir->reg.enable);
-			return mem->ir->reg.enable;
-		}
-
-		// I/O control
-		WARN("Reading I/O still not handled.\n");
-		return 0;
+		// I/O registers & interrupt enable
+		return memory_io_read(mem, addr);
 	}
 
 	if (offset == NULL)
@@ -308,50 +853,55 @@ uint16_t memory_read_word(memory* mem, uint16_t addr) {
 	return (uint16_t)((memory_read_byte(mem, addr)) + (memory_read_byte(mem, addr + 1) << 8));
 }
 
+// MBC registers (0x0000-0x7FFF) & external RAM
 static void memory_write_byte_membank(memory* mem, uint16_t addr, uint8_t value) {
-	if (mem->mbc_mode == 0)
+	if (addr >= 0xA000) {
+		if (mem->mbc == MEMORY_MBC_NONE)
+			return;
+
+		// First write since the last sync, the next ones go direct
+		if (mem->battery && !mem->ram_dirty) {
+			mem->ram_dirty = 1;
+			memory_map_pages(mem, 0xA0, 0xBF);
+		}
+
+		if (mem->tr != NULL)
+			dbt_notify_write(mem->tr, addr);
+		mem->ram_bank_base[addr] = value;
 		return;
+	}
 
-	switch((addr & 0xF000) >> 12) {
-	case 0x1:
-		mem->ram_on = ((value & 0x0F) == 0x0A);
+	switch (mem->mbc) {
+	case MEMORY_MBC1:
+		memory_mbc1_write(mem, addr, value);
 		break;
-	case 0x2:
-	case 0x3:
-		value &= 0x0F;
-		if (!value) value = 1;
-		mem->mbc_cur_offset = value * 0x4000;
+	case MEMORY_MBC2:
+		memory_mbc2_write(mem, addr, value);
 		break;
-	case 0x4:
-	case 0x5:
-		if (mem->rom_ram_mode)
-			mem->ram_cur_offset = (value & 0x3) * 0x2000;
-		else
-			mem->mbc_cur_offset = ((mem->mbc_cur_offset / 0x4000) & 0x1F) + ((value >> 4) & 3) * 0x4000;
+	case MEMORY_MBC3:
+		memory_mbc3_write(mem, addr, value);
 		break;
-	case 0x6:
-	case 0x7:
-		mem->rom_ram_mode = value & 0x1;
+	case MEMORY_MBC5:
+		memory_mbc5_write(mem, addr, value);
 		break;
-	case 0xA:
-	case 0xB:
-		*(uint8_t*)(mem->external - 0xA000 + mem->ram_cur_offset + addr) = value;
+	case MEMORY_MBC_NONE:
 		break;
 	}
 }
 
-void memory_write_byte(memory* mem, uint16_t addr, uint8_t value) {
+void memory_write_byte_slow(memory* mem, uint16_t addr, uint8_t value) {
 	void* offset = NULL;
+
+	if (memory_dma_blocks(mem, addr))
+		return;
 	switch ((addr & 0xF000) >> 12) {
 		// Cartridge ROM, bank 0
 	case 0x0:
-		// BIOS
-		if ((addr & 0xFF00) == 0 && mem->in_bios)
+		// BIOS, else an MBC register
+		if ((addr & 0xFF00) == 0 && mem->in_bios) {
 			offset = mem->bios;
-		else
-			ERROR("Write in ROM.\n");
-		break;
-
+			break;
+		}
 	case 0x1:
 	case 0x2:
 	case 0x3:
@@ -366,19 +916,32 @@ void memory_write_byte(memory* mem, uint16_t addr, uint8_t value) {
 	case 0x8:
 	case 0x9:
 		offset = mem->gpu - 0x8000;
+		if (addr < 0x9800)
+			gpu_invalidate_tile(mem->gp, addr);
 		break;
 
 		// Cartridge (External) RAM
 	case 0xA:
 	case 0xB:
+		if (memory_rtc_selected(mem)) {
+			memory_rtc_write(mem, value);
+			return;
+		}
+
+		// MBC2 RAM is repeated over the region and only stores half bytes
+		if (mem->mbc == MEMORY_MBC2) {
+			memory_write_byte_membank(mem, 0xA000 | (addr & (MEMORY_MBC2_RAM_SIZE - 1)), value & 0x0F);
+			return;
+		}
+
 		if (mem->ram_size == 0)
-			ERROR("Reading external ram but none present.\n");
+			ERROR("Writing external ram but none present.\n");
 
-		if (addr - 0xA000 > mem->ram_size)
+		if (mem->ram_cur_offset + addr - 0xA000 >= mem->ram_size)
 			ERROR("Writing outside external RAM\n");
 
 		memory_write_byte_membank(mem, addr, value);
-		break;
+		return;
 
 		// Working RAM
 	case 0xC:
@@ -408,140 +971,21 @@ void memory_write_byte(memory* mem, uint16_t addr, uint8_t value) {
 			break;
 		}
 
-		// Timer register
-
-		// Timer divider
-		if (addr == 0xFF04) {
-			DEBUG_TIMER("Setting Timer Divider register to %X\n", 0);
-			mem->t->reg.divider = 0x0;
-			return;
-		}
-
-		// Timer counter
-		if (addr == 0xFF05) {
-			DEBUG_TIMER("Setting Timer Counter register to %X\n", value);
-			mem->t->reg.counter = value;
-			return;
-		}
-
-		// Timer modulo
-		if (addr == 0xFF06) {
-			DEBUG_TIMER("Setting Timer Modulo register to %X\n", value);
-			mem->t->reg.modulo = value;
-			return;
-		}
-
-		// Timer control
-		if (addr == 0xFF07) {
-			DEBUG_TIMER("Setting Timer Control register to %X\n", value & 0x7);
-			mem->t->reg.control = value & 0x7;
-			return;
-		}
-
-		// GPU register
-
-		// LCD control
-		if (addr == 0xFF40) {
-			DEBUG_MEMORY("Setting GPU LCD control to %x\n", value);
-			mem->gp->reg.control = value;
-			return;
-		}
-
-		// LCD Status
-		if (addr == 0xFF41) {
-			DEBUG_MEMORY("Setting GPU LCD_status to %x\n", value);
-			mem->gp->reg.status = value;
-			return;
-		}
-
-		// Scroll Y
-		if (addr == 0xFF42) {
-			DEBUG_MEMORY("Setting GPU scroll_y to %x\n", value);
-			mem->gp->reg.scroll_y = value;
-			return;
-		}
-
-		// Scroll X
-		if (addr == 0xFF43) {
-			DEBUG_MEMORY("Setting GPU scroll_x to %x\n", value);
-			mem->gp->reg.scroll_x = value;
-			return;
-		}
-
-		// Check scan line
-		if (addr == 0xFF45) {
-			DEBUG_MEMORY("Setting GPU check scanline to %x\n", value);
-			mem->gp->reg.check_line = value;
-			return;
-		}
-
-		// Background Palette
-		if (addr == 0xFF47) {
-			DEBUG_MEMORY("Setting GPU background palette to %x\n", value);
-			mem->gp->reg.bg_pal = value;
-			return;
-		}
-
-		// Sprite Palette 0
-		if (addr == 0xFF48) {
-			DEBUG_MEMORY("Setting GPU sprite palette 0 to %x\n", value);
-			mem->gp->reg.sp_pal_0 = value;
-			return;
-		}
-
-		// Sprite Palette 1
-		if (addr == 0xFF49) {
-			DEBUG_MEMORY("Setting GPU sprite palette 1 to %x\n", value);
-			mem->gp->reg.sp_pal_1 = value;
-			return;
-		}
-
-		// Bios mode
-		if (addr == 0xFF50 && mem->in_bios) {
-			DEBUG_MEMORY("Setting in_bios to %X\n", !value);
-			mem->in_bios = !value;
-			return;
-		}
-
-		// Keyboard Register
-		if (addr == 0xFF00) {
-			DEBUG_MEMORY("Setting keyboard register to %X\n", value);
-			mem->kb->reg.active = value;
-			return;
-		}
-
-		// Interrupt flags
-		if (addr == 0xFF0F) {
-			DEBUG_INTERRUPTS("Setting interrupt flags to %X\n", value);
-			mem->ir->reg.flags = value;
-			return;
-		}
-
-		// Interrupt enable
-		if (addr == 0xFFFF) {
-			DEBUG_INTERRUPTS("Setting interrupt enable register to %X\n", value);
-			mem->ir->reg.enable = value;
-			return;
-		}
-
-		// DMA transfert
-		if (addr == 0xFF46) {
-			DEBUG_MEMORY("Starting DMA transfert for %X\n", value);
-			memory_dma_transfert(mem, value << 8, 0xFE00, 0xA0);
-			return;
-		}
-
 		// Zero page
-		if (addr >= 0xFF80 && addr <= 0xFFFE) {
+		if (addr >= 0xFF80 && addr != 0xFFFF) {
 			offset = mem->zero - 0xFF80;
 			break;
 		}
 
-		// I/O control
-		WARN("Writing I/O still not handled for 0x%X.\n", addr);
+		// I/O registers & interrupt enable
+		memory_io_write(mem, addr, value);
 		return;
 	}
 
+	// Translated code may be overwritten
+	if (mem->tr != NULL)
+		dbt_notify_write(mem->tr, addr);
+
 	*(uint8_t*)(offset + addr) = value;
 }
 
@@ -8,16 +8,99 @@ typedef struct gpu gpu;
 typedef struct keyboard keyboard;
 typedef struct interrupts interrupts;
 typedef struct timer timer;
+typedef struct dbt dbt;
+typedef struct scheduler scheduler;
+typedef struct scheduler_event scheduler_event;
+
+// I/O register handlers, dev is the component given at registration
+typedef uint8_t (*memory_io_reader)(void* dev, uint16_t addr);
+typedef void (*memory_io_writer)(void* dev, uint16_t addr, uint8_t value);
+
+typedef struct memory_io {
+	memory_io_reader read;
+	memory_io_writer write;
+	void* dev;
+} memory_io;
+
+// Memory bank controller of the cartridge
+typedef enum {
+	MEMORY_MBC_NONE,
+	MEMORY_MBC1,
+	MEMORY_MBC2,
+	MEMORY_MBC3,
+	MEMORY_MBC5
+} memory_mbc;
+
+#define MEMORY_ROM_BANK_SIZE 0x4000
+#define MEMORY_RAM_BANK_SIZE 0x2000
+#define MEMORY_MBC2_RAM_SIZE 0x200
+#define MEMORY_RTC_SECONDS   0x08 // First MBC3 RAM bank number selecting a clock register
+#define MEMORY_RTC_DAYS      512  // Days counted before the clock overflows
+#define MEMORY_DMA_LENGTH    0xA0  // Bytes copied to OAM
+#define MEMORY_DMA_CYCLES    160   // Bus blocked by an OAM DMA
+#define MEMORY_SAVE_PERIOD   1048576 // Cycles between two syncs of the save file, a second
+
+// MBC3 real time clock, counting emulated seconds. The counter is computed
+// from the cycle it was zero at, only the latched registers are stored. The
+// host time elapsed while the emulator was closed is added on load.
+typedef struct memory_rtc {
+	uint64_t base;    // Cycle the counter was zero at, while running
+	uint64_t seconds; // Counter, while halted
+	uint8_t halt;
+	uint8_t carry;    // Day counter overflowed
+	uint8_t latch;    // Last value written to the latch register
+	uint8_t regs[5];  // Latched seconds, minutes, hours, day low, day high
+} memory_rtc;
+
+// Clock appended to the save file, in the layout most emulators share:
+// running registers, latched registers, then the host time of the store
+typedef struct memory_rtc_save {
+	uint32_t current[5];
+	uint32_t latched[5];
+	uint64_t timestamp;
+} memory_rtc_save;
+
+// 0xFF00-0xFF7F, then the interrupt enable register (0xFFFF)
+#define MEMORY_IO_COUNT  0x81
+#define MEMORY_IO_ENABLE 0x80
 
 typedef struct memory {
 	uint8_t in_bios;
-	uint8_t mbc_mode;
+	uint8_t mbc_mode; // Cartridge type
+	memory_mbc mbc;
 	uint8_t rom_ram_mode;
 	uint8_t ram_on;
 	uint32_t ram_size;
 	uint32_t rom_size;
-	uint16_t mbc_cur_offset;
-	uint16_t ram_cur_offset;
+
+	// Bank registers as written, then the offsets of the selected banks
+	uint16_t rom_bank;
+	uint8_t ram_bank;
+	uint32_t mbc_cur_offset;
+	uint32_t ram_cur_offset;
+
+	// Switchable regions base, indexed by the address. A bank switch only
+	// swaps these and the page table entries.
+	uint8_t* rom_bank_base; // 0x4000-0x7FFF
+	uint8_t* ram_bank_base; // 0xA000-0xBFFF, NULL without RAM or on a clock register
+	memory_rtc rtc;
+
+	// Battery backed RAM is the mapping of the save file. Its pages are
+	// write protected until the first write after each sync, which sets
+	// the dirty flag.
+	uint8_t battery;
+	uint8_t ram_dirty;
+	uint32_t save_size; // RAM, then the clock when there is one
+	memory_rtc_save* rtc_save; // Clock in the save file, NULL without clock
+	scheduler_event *save_ev;
+
+	// OAM DMA in progress, the CPU only reaches I/O and HRAM until dma_ev
+	uint8_t dma_active;
+	scheduler_event *dma_ev;
+
+	// Set on every I/O register access, pending events ran and may have
+	// raised interrupts or started a DMA
+	uint8_t io_access;
 
 	uint8_t* bios;
 	uint8_t* rom;
@@ -30,6 +113,15 @@ typedef struct memory {
 	keyboard *kb;
 	interrupts *ir;
 	timer *t;
+	dbt *tr;
+	scheduler *sch;
+
+	// Direct access to each 256 bytes page, NULL if the page needs the slow
+	// path (I/O, MBC registers, translated code, out of bounds)
+	uint8_t* read_pages[0x100];
+	uint8_t* write_pages[0x100];
+
+	memory_io io[MEMORY_IO_COUNT];
 } memory;
 
 memory* memory_init(GB *rom);
@@ -38,11 +130,35 @@ void memory_end(memory* mem);
 void memory_set_gpu(memory* mem, gpu* gp);
 void memory_set_interrupts(memory* mem, interrupts* ir);
 void memory_set_timer(memory* mem, timer* t);
+void memory_set_dbt(memory* mem, dbt* tr);
+void memory_set_scheduler(memory* mem, scheduler* sch);
+void memory_register_io(memory* mem, uint16_t addr, memory_io_reader read, memory_io_writer write, void* dev);
 
-uint8_t memory_read_byte(memory* mem, uint16_t addr);
+uint32_t memory_rom_offset(memory* mem, uint16_t addr);
+void memory_map_page(memory* mem, uint8_t page);
+
+uint8_t memory_read_byte_slow(memory* mem, uint16_t addr);
 uint16_t memory_read_word(memory* mem, uint16_t addr);
 
-void memory_write_byte(memory* mem, uint16_t addr, uint8_t value);
+void memory_write_byte_slow(memory* mem, uint16_t addr, uint8_t value);
 void memory_write_word(memory* mem, uint16_t addr, uint16_t value);
 
+// Plain RAM/ROM accesses go through the page table, the others through the
+// slow path
+static inline uint8_t memory_read_byte(memory* mem, uint16_t addr) {
+	uint8_t* page = mem->read_pages[addr >> 8];
+	if (page != NULL)
+		return page[addr & 0xFF];
+
+	return memory_read_byte_slow(mem, addr);
+}
+
+static inline void memory_write_byte(memory* mem, uint16_t addr, uint8_t value) {
+	uint8_t* page = mem->write_pages[addr >> 8];
+	if (page != NULL)
+		page[addr & 0xFF] = value;
+	else
+		memory_write_byte_slow(mem, addr, value);
+}
+
 #endif     // __MEMORY_H__
@@ -1,1707 +1,1179 @@
 #include <stdlib.h>
 #include "opcodes.h"
+#include "interrupts.h"
 #include "log.h"
 
 // Init opcodes if needed
 void opcodes_init() {
 }
 
-// All opcode functions below.
-
-// An opcode function. Take the current machine state and the memory and return
-// the number of cycles taken by the instruction.
-
-
-// Decide which register is concerned.
-// Return NULL if (HL) register
-static uint8_t* resolve_register(uint8_t z, state *st) {
-	switch (z) {
-	case 0:
-		return &(st->reg.B);
-	case 1:
-		return &(st->reg.C);
-	case 2:
-		return &(st->reg.D);
-	case 3:
-		return &(st->reg.E);
-	case 4:
-		return &(st->reg.H);
-	case 5:
-		return &(st->reg.L);
-	case 6:
-		return NULL;
-	case 7:
-		return &(st->reg.A);
-	}
+// Registers helpers
+
+#define HL_ADDR(st) (((st)->reg.H << 8) + (st)->reg.L)
+
+static inline uint16_t get_BC(state* st) { return (st->reg.B << 8) + st->reg.C; }
+static inline uint16_t get_DE(state* st) { return (st->reg.D << 8) + st->reg.E; }
+static inline uint16_t get_HL(state* st) { return (st->reg.H << 8) + st->reg.L; }
+static inline uint16_t get_SP(state* st) { return st->reg.SP; }
+static inline uint16_t get_AF(state* st) { return (st->reg.A << 8) + st->reg.F; }
+
+static inline void set_BC(state* st, uint16_t v) { st->reg.B = v >> 8; st->reg.C = v; }
+static inline void set_DE(state* st, uint16_t v) { st->reg.D = v >> 8; st->reg.E = v; }
+static inline void set_HL(state* st, uint16_t v) { st->reg.H = v >> 8; st->reg.L = v; }
+static inline void set_SP(state* st, uint16_t v) { st->reg.SP = v; }
+// F register, only up nibble
+static inline void set_AF(state* st, uint16_t v) { st->reg.A = v >> 8; st->reg.F = v & 0xF0; }
+
+// 8-bit operands, in the r[z] decoding order of http://www.z80.info/decoding.htm
+// (B, C, D, E, H, L, (HL), A). HL stands for the (HL) memory operand.
+#define LOAD_B(st, mem)  ((st)->reg.B)
+#define LOAD_C(st, mem)  ((st)->reg.C)
+#define LOAD_D(st, mem)  ((st)->reg.D)
+#define LOAD_E(st, mem)  ((st)->reg.E)
+#define LOAD_H(st, mem)  ((st)->reg.H)
+#define LOAD_L(st, mem)  ((st)->reg.L)
+#define LOAD_HL(st, mem) memory_read_byte((mem), HL_ADDR(st))
+#define LOAD_A(st, mem)  ((st)->reg.A)
+
+#define STORE_B(st, mem, v)  ((st)->reg.B = (v))
+#define STORE_C(st, mem, v)  ((st)->reg.C = (v))
+#define STORE_D(st, mem, v)  ((st)->reg.D = (v))
+#define STORE_E(st, mem, v)  ((st)->reg.E = (v))
+#define STORE_H(st, mem, v)  ((st)->reg.H = (v))
+#define STORE_L(st, mem, v)  ((st)->reg.L = (v))
+#define STORE_HL(st, mem, v) memory_write_byte((mem), HL_ADDR(st), (v))
+#define STORE_A(st, mem, v)  ((st)->reg.A = (v))
+
+#define NAME_B  "B"
+#define NAME_C  "C"
+#define NAME_D  "D"
+#define NAME_E  "E"
+#define NAME_H  "H"
+#define NAME_L  "L"
+#define NAME_HL "(HL)"
+#define NAME_A  "A"
+
+// Instantiate M for each 8-bit operand
+#define FOR_EACH_OPERAND(M, arg)				\
+	M(arg, B) M(arg, C) M(arg, D) M(arg, E)		\
+	M(arg, H) M(arg, L) M(arg, HL) M(arg, A)
+
+// Table row of the 8 handlers prefix_r[z] starting at opcode base
+#define ROW_OPERANDS(base, prefix)									\
+	[(base) + 0] = prefix##_B, [(base) + 1] = prefix##_C,			\
+	[(base) + 2] = prefix##_D, [(base) + 3] = prefix##_E,			\
+	[(base) + 4] = prefix##_H, [(base) + 5] = prefix##_L,			\
+	[(base) + 6] = prefix##_HL, [(base) + 7] = prefix##_A
+
+// Conditions -- cc[y]
+#define COND_NZ(st) (((st)->reg.F & FLAG_ZERO) == 0)
+#define COND_Z(st)  (((st)->reg.F & FLAG_ZERO) != 0)
+#define COND_NC(st) (((st)->reg.F & FLAG_CARRY) == 0)
+#define COND_C(st)  (((st)->reg.F & FLAG_CARRY) != 0)
+
+#define FOR_EACH_COND(M) M(NZ) M(Z) M(NC) M(C)
+
+// Invalid opcode on GB (Z80 only instructions)
+static int8_t op_invalid(state* st, memory* mem, uint16_t imm) {
+	ERROR("Opcode %X is not available on GB\n", memory_read_byte(mem, st->reg.PC - 1));
+	return -1;
+}
 
-	ERROR("Resolve register for unknown z=%d\n", z);
-	return NULL;
+/******************************************************************************
+ * Extended instructions (0xCB prefix)
+ ******************************************************************************/
+
+// Rotations: each one returns the new value and the carry out
+static inline uint8_t rot_RLC(state* st, uint8_t v, uint8_t* co) {
+	*co = v & 0x80 ? FLAG_CARRY : 0;
+	return (v << 1) | (v >> 7);
 }
 
-#ifndef NDEBUG_OPCODES
-static const char* resolve_register_name(uint8_t z) {
-	switch (z) {
-	case 0:
-		return "B";
-	case 1:
-		return "C";
-	case 2:
-		return "D";
-	case 3:
-		return "E";
-	case 4:
-		return "H";
-	case 5:
-		return "L";
-	case 6:
-		return "(HL)";
-	case 7:
-		return "A";
-	}
-	return "?";
+static inline uint8_t rot_RRC(state* st, uint8_t v, uint8_t* co) {
+	*co = v & 0x1 ? FLAG_CARRY : 0;
+	return (v >> 1) | (v << 7);
 }
-#endif
-
-// Extended instructions (rotation related)
-static int8_t handle_roll(uint8_t y, uint8_t z, state *st, memory* mem) {
-	uint8_t* reg = resolve_register(z, st);
-	uint8_t ci = 0;
-	uint8_t co = 0;
-
-	// Get data from memory for (HL)
-	uint8_t is_hl = reg == NULL;
-	uint8_t hl_value = 0;
-	if (is_hl) {
-		hl_value = memory_read_byte(mem, (st->reg.H << 8) + st->reg.L);
-		reg = &hl_value;
-	}
 
-	switch(y) {
-		// RLC
-	case 0:
-		DEBUG_OPCODES("RLC %s\n", resolve_register_name(z));
-		ci = *reg & 0x80 ? 1 : 0;
-		co = *reg & 0x80 ? FLAG_CARRY : 0;
-		*reg = (*reg << 1);
-
-		break;
-
-		// RRC
-	case 1:
-		DEBUG_OPCODES("RRC %s\n", resolve_register_name(z));
-		ci = *reg & 0x1 ? 0x80 : 0;
-		co = *reg & 0x1 ? FLAG_CARRY : 0;
-		*reg = (*reg >> 1);
-		break;
-
-		// RL
-	case 2:
-		DEBUG_OPCODES("RL %s\n", resolve_register_name(z));
-		ci = st->reg.F & FLAG_CARRY ? 1 : 0;
-		co = *reg & 0x80 ? FLAG_CARRY : 0;
-		*reg = (*reg << 1);
-		break;
-
-		// RR
-	case 3:
-		DEBUG_OPCODES("RR %s\n", resolve_register_name(z));
-		ci = st->reg.F & FLAG_CARRY ? 0x80 : 0;
-		co = *reg & 0x1 ? FLAG_CARRY : 0;
-		*reg = (*reg >> 1);
-		break;
-
-		// SLA
-	case 4:
-		DEBUG_OPCODES("SLA %s\n", resolve_register_name(z));
-		ci = 0;
-		co = *reg & 0x80 ? FLAG_CARRY : 0;
-		*reg = (*reg << 1);
-		break;
-
-		// SRA
-	case 5:
-		DEBUG_OPCODES("SRA %s\n", resolve_register_name(z));
-		ci = *reg & 0x80;
-		co = *reg & 0x1 ? FLAG_CARRY : 0;
-		*reg = (*reg >> 1);
-		break;
-
-		// Special gameboy case SWAP
-	case 6:
-		DEBUG_OPCODES("SWAP %s\n", resolve_register_name(z));
-		ci = 0;
-		co = 0;
-		*reg = ((*reg&0x0F) << 4) | ((*reg & 0xF0) >> 4);
-		st->reg.F &= ~FLAG_CARRY;
-		break;
-
-		// SRL
-	case 7:
-		DEBUG_OPCODES("SRL %s\n", resolve_register_name(z));
-		ci = 0;
-		co = *reg & 0x1 ? FLAG_CARRY : 0;
-		*reg = (*reg >> 1);
-		break;
-	}
+static inline uint8_t rot_RL(state* st, uint8_t v, uint8_t* co) {
+	*co = v & 0x80 ? FLAG_CARRY : 0;
+	return (v << 1) | (st->reg.F & FLAG_CARRY ? 1 : 0);
+}
 
-    // General operations
-	*reg += ci;
-	st->reg.F = *reg ? 0 : FLAG_ZERO;
-	st->reg.F |= co;
+static inline uint8_t rot_RR(state* st, uint8_t v, uint8_t* co) {
+	*co = v & 0x1 ? FLAG_CARRY : 0;
+	return (v >> 1) | (st->reg.F & FLAG_CARRY ? 0x80 : 0);
+}
 
-	st->reg.F &= ~FLAG_HALF_CARRY;
-	st->reg.F &= ~FLAG_SUBSTRACTION;
+static inline uint8_t rot_SLA(state* st, uint8_t v, uint8_t* co) {
+	*co = v & 0x80 ? FLAG_CARRY : 0;
+	return v << 1;
+}
 
-	// Write result to memory
-	if (is_hl) {
-		memory_write_byte(mem, (st->reg.H << 8) + st->reg.L, *reg);
-		return 4;
-	} else {
-		return 2;
-	}
+static inline uint8_t rot_SRA(state* st, uint8_t v, uint8_t* co) {
+	*co = v & 0x1 ? FLAG_CARRY : 0;
+	return (v >> 1) | (v & 0x80);
 }
 
-// Check if a bit is set -- BIT y, r[z]
-static int8_t handle_bit(uint8_t y, uint8_t z, state *st, memory* mem) {
-	uint8_t* reg = resolve_register(z, st);
+// Special gameboy case SWAP
+static inline uint8_t rot_SWAP(state* st, uint8_t v, uint8_t* co) {
+	*co = 0;
+	return ((v & 0x0F) << 4) | ((v & 0xF0) >> 4);
+}
 
-	DEBUG_OPCODES("BIT %d, %s\n", y, resolve_register_name(z));
+static inline uint8_t rot_SRL(state* st, uint8_t v, uint8_t* co) {
+	*co = v & 0x1 ? FLAG_CARRY : 0;
+	return v >> 1;
+}
 
-	// Get data from memory for (HL)
-	uint8_t is_hl = reg == NULL;
-	uint8_t hl_value = 0;
-	if (is_hl) {
-		hl_value = memory_read_byte(mem, (st->reg.H << 8) + st->reg.L);
-		reg = &hl_value;
+// Rotation -- rot[y] r[z]
+#define DEFINE_CB_ROT(rot, r)												\
+	static int8_t cb_##rot##_##r(state* st, memory* mem, uint16_t imm) {	\
+		DEBUG_OPCODES(#rot " %s\n", NAME_##r);								\
+		uint8_t co = 0;														\
+		uint8_t v = rot_##rot(st, LOAD_##r(st, mem), &co);					\
+		st->reg.F = (v ? 0 : FLAG_ZERO) | co;								\
+		STORE_##r(st, mem, v);												\
+		return 0;															\
 	}
 
-	st->reg.F &= ~FLAG_SUBSTRACTION;
-	st->reg.F |= FLAG_HALF_CARRY;
-	st->reg.F &= ~FLAG_ZERO;
-	st->reg.F |= *reg & (1 << y) ? 0 : FLAG_ZERO;
-
-	if (is_hl)
-		return 3;
-	else
-		return 2;
-}
+// Check if a bit is set -- BIT y, r[z]
+#define DEFINE_CB_BIT(y, r)													\
+	static int8_t cb_BIT_##y##_##r(state* st, memory* mem, uint16_t imm) {	\
+		DEBUG_OPCODES("BIT %d, %s\n", y, NAME_##r);							\
+		st->reg.F &= ~(FLAG_SUBSTRACTION | FLAG_ZERO);						\
+		st->reg.F |= FLAG_HALF_CARRY;										\
+		st->reg.F |= LOAD_##r(st, mem) & (1 << y) ? 0 : FLAG_ZERO;			\
+		return 0;															\
+	}
 
 // Set to 0 a specific bit -- RES y, r[z]
-static int8_t handle_res(uint8_t y, uint8_t z, state *st, memory* mem) {
-	uint8_t* reg = resolve_register(z, st);
-
-	DEBUG_OPCODES("RES %d, %s\n", y, resolve_register_name(z));
-
-	// Get data from memory for (HL)
-	uint8_t is_hl = reg == NULL;
-	uint8_t hl_value = 0;
-	if (is_hl) {
-		hl_value = memory_read_byte(mem, (st->reg.H << 8) + st->reg.L);
-		reg = &hl_value;
+#define DEFINE_CB_RES(y, r)													\
+	static int8_t cb_RES_##y##_##r(state* st, memory* mem, uint16_t imm) {	\
+		DEBUG_OPCODES("RES %d, %s\n", y, NAME_##r);							\
+		STORE_##r(st, mem, LOAD_##r(st, mem) & ~(1 << y));					\
+		return 0;															\
 	}
 
-	*reg &= ~(1 << y);
-
-	if (is_hl) {
-		memory_write_byte(mem, (st->reg.H << 8) + st->reg.L, *reg);
-		return 4;
-	} else {
+// Set to 1 a specific bit -- SET y, r[z]
+#define DEFINE_CB_SET(y, r)													\
+	static int8_t cb_SET_##y##_##r(state* st, memory* mem, uint16_t imm) {	\
+		DEBUG_OPCODES("SET %d, %s\n", y, NAME_##r);							\
+		STORE_##r(st, mem, LOAD_##r(st, mem) | (1 << y));					\
+		return 0;															\
+	}
+
+FOR_EACH_OPERAND(DEFINE_CB_ROT, RLC)
+FOR_EACH_OPERAND(DEFINE_CB_ROT, RRC)
+FOR_EACH_OPERAND(DEFINE_CB_ROT, RL)
+FOR_EACH_OPERAND(DEFINE_CB_ROT, RR)
+FOR_EACH_OPERAND(DEFINE_CB_ROT, SLA)
+FOR_EACH_OPERAND(DEFINE_CB_ROT, SRA)
+FOR_EACH_OPERAND(DEFINE_CB_ROT, SWAP)
+FOR_EACH_OPERAND(DEFINE_CB_ROT, SRL)
+
+#define DEFINE_CB_BITS(M)												\
+	FOR_EACH_OPERAND(M, 0) FOR_EACH_OPERAND(M, 1)						\
+	FOR_EACH_OPERAND(M, 2) FOR_EACH_OPERAND(M, 3)						\
+	FOR_EACH_OPERAND(M, 4) FOR_EACH_OPERAND(M, 5)						\
+	FOR_EACH_OPERAND(M, 6) FOR_EACH_OPERAND(M, 7)
+
+DEFINE_CB_BITS(DEFINE_CB_BIT)
+DEFINE_CB_BITS(DEFINE_CB_RES)
+DEFINE_CB_BITS(DEFINE_CB_SET)
+
+#define ROW_CB_BITS(base, op)											\
+	ROW_OPERANDS((base) + 0x00, cb_##op##_0),							\
+	ROW_OPERANDS((base) + 0x08, cb_##op##_1),							\
+	ROW_OPERANDS((base) + 0x10, cb_##op##_2),							\
+	ROW_OPERANDS((base) + 0x18, cb_##op##_3),							\
+	ROW_OPERANDS((base) + 0x20, cb_##op##_4),							\
+	ROW_OPERANDS((base) + 0x28, cb_##op##_5),							\
+	ROW_OPERANDS((base) + 0x30, cb_##op##_6),							\
+	ROW_OPERANDS((base) + 0x38, cb_##op##_7)
+
+static const opcode_handler cb_opcodes_table[256] = {
+	// x = 0: rotations
+	ROW_OPERANDS(0x00, cb_RLC),
+	ROW_OPERANDS(0x08, cb_RRC),
+	ROW_OPERANDS(0x10, cb_RL),
+	ROW_OPERANDS(0x18, cb_RR),
+	ROW_OPERANDS(0x20, cb_SLA),
+	ROW_OPERANDS(0x28, cb_SRA),
+	ROW_OPERANDS(0x30, cb_SWAP),
+	ROW_OPERANDS(0x38, cb_SRL),
+
+	// x = 1, 2, 3: bits operations
+	ROW_CB_BITS(0x40, BIT),
+	ROW_CB_BITS(0x80, RES),
+	ROW_CB_BITS(0xC0, SET),
+};
+
+
+// Base cycles of the 0xCB prefixed opcodes, prefix included
+static inline uint8_t cb_opcodes_cycles(z80_opcode opcode) {
+	if ((opcode & 0x07) != 6)
 		return 2;
-	}
+
+	// BIT b, (HL) only reads memory
+	return (opcode & 0xC0) == 0x40 ? 3 : 4;
 }
 
-// Set to 1 a specific bit -- SET y, r[z]
-static int8_t handle_set(uint8_t y, uint8_t z, state *st, memory* mem) {
-	uint8_t* reg = resolve_register(z, st);
+// 0xCB prefix, fetch the extra opcode
+static int8_t op_prefix_CB(state* st, memory* mem, uint16_t imm) {
+	return cb_opcodes_cycles(imm) + cb_opcodes_table[imm](st, mem, 0);
+}
 
-	DEBUG_OPCODES("SET %d, %s\n", y, resolve_register_name(z));
+/******************************************************************************
+ * x = 0
+ ******************************************************************************/
 
-	// Get data from memory for (HL)
-	uint8_t is_hl = reg == NULL;
-	uint8_t hl_value = 0;
-	if (is_hl) {
-		hl_value = memory_read_byte(mem, (st->reg.H << 8) + st->reg.L);
-		reg = &hl_value;
-	}
+// NOP
+static int8_t op_NOP(state* st, memory* mem, uint16_t imm) {
+	DEBUG_OPCODES("NOP\n");
+	return 0;
+}
 
-	*reg |= 1 << y;
+// LD (nn), SP
+static int8_t op_LD_nn_SP(state* st, memory* mem, uint16_t imm) {
+	DEBUG_OPCODES("LD (nn=%X), SP\n", imm);
 
-	if (is_hl) {
-		memory_write_byte(mem, (st->reg.H << 8) + st->reg.L, *reg);
-		return 4;
-	} else {
-		return 2;
-	}
+	memory_write_word(mem, imm, st->reg.SP);
+	return 0;
 }
 
-#ifndef NDEBUG_OPCODES
-static const char* resolve_cc(uint8_t y) {
-	switch(y) {
-	case 0:
-		return "NZ";
-	case 1:
-		return "Z";
-	case 2:
-		return "NC";
-	case 3:
-		return "C";
-	default:
-		return "?";
-	}
+// STOP
+static int8_t op_STOP(state* st, memory* mem, uint16_t imm) {
+	DEBUG_OPCODES("STOP\n");
+	st->stop_mode = 1;
+	return 0;
 }
-#endif
-
-// Relative jumps and assorted ops
-static int8_t handle_no_extra_x_0_z_0(uint8_t y, uint8_t z, uint8_t p, uint8_t q, state* st, memory* mem) {
-	switch (y) {
-		// NOP
-	case 0:
-		DEBUG_OPCODES("NOP\n");
-		return 1;
-
-		// LD (nn), SP
-	case 1:
-	{
-		uint16_t nn = memory_read_word(mem, st->reg.PC);
-		st->reg.PC += 2;
-		DEBUG_OPCODES("LD (nn=%X), SP\n", nn);
 
-		memory_write_word(mem, nn, st->reg.SP);
+// JR d
+static int8_t op_JR(state* st, memory* mem, uint16_t imm) {
+	int8_t nn = imm;
 
-		return 5;
-	}
-		// STOP
-	case 2:
-	{
-		DEBUG_OPCODES("STOP\n");
-		st->stop_mode = 1;
-		return 1;
-	}
-		// JR d
-	case 3:
-	{
-		int8_t nn = memory_read_byte(mem, st->reg.PC);
-		st->reg.PC++;
+	DEBUG_OPCODES("JR %d\n", nn);
 
-		DEBUG_OPCODES("JR %d\n", nn);
+	st->reg.PC += nn;
+	return 0;
+}
 
-		st->reg.PC += nn;
-		return 3;
-	}
-		// JR cc[y-4], d
-	case 4:
-	case 5:
-	case 6:
-	case 7:
-	{
-		int8_t nn = memory_read_byte(mem, st->reg.PC);
-		st->reg.PC++;
-		uint8_t do_jump = 0;
-
-		DEBUG_OPCODES("JR %s, %d\n", resolve_cc(y-4), nn);
-
-		// JR NZ, d
-		if (y == 4)
-			do_jump = (st->reg.F & FLAG_ZERO) == 0;
-		// JR Z, d
-		else if (y == 5)
-			do_jump = (st->reg.F & FLAG_ZERO) != 0;
-		// JR NC, d
-		else if (y == 6)
-			do_jump = (st->reg.F & FLAG_CARRY) == 0;
-		// JR C, d
-		else if (y == 7)
-			do_jump = (st->reg.F & FLAG_CARRY) != 0;
-
-		if (do_jump) {
-			st->reg.PC += nn;
-			return 3;
-		} else {
-			return 2;
-		}
-	}
-	}
+// JR cc[y-4], d
+#define DEFINE_JR_CC(cc)												\
+	static int8_t op_JR_##cc(state* st, memory* mem, uint16_t imm) {	\
+		int8_t nn = imm;												\
+		DEBUG_OPCODES("JR " #cc ", %d\n", nn);							\
+		if (COND_##cc(st)) {											\
+			st->reg.PC += nn;											\
+			return 1;													\
+		}																\
+		return 0;														\
+	}
+
+FOR_EACH_COND(DEFINE_JR_CC)
+
+// 16-bit load immediate -- LD rp[p], nn
+#define DEFINE_LD_RP_NN(rp)													\
+	static int8_t op_LD_##rp##_nn(state* st, memory* mem, uint16_t imm) {	\
+		set_##rp(st, imm);													\
+		DEBUG_OPCODES("LD " #rp ", %X\n", get_##rp(st));					\
+		return 0;															\
+	}
+
+// 16-bit add -- ADD HL, rp[p]
+#define DEFINE_ADD_HL_RP(rp)												\
+	static int8_t op_ADD_HL_##rp(state* st, memory* mem, uint16_t imm) {	\
+		DEBUG_OPCODES("ADD HL, " #rp "\n");									\
+		uint16_t hl = get_HL(st);											\
+		uint32_t res = hl + get_##rp(st);									\
+		st->reg.F &= FLAG_ZERO;												\
+		if ((hl & 0xFFF) > (res & 0xFFF))									\
+			st->reg.F |= FLAG_HALF_CARRY;									\
+		if (res > 0xFFFF)													\
+			st->reg.F |= FLAG_CARRY;										\
+		set_HL(st, res);													\
+		return 0;															\
+	}
+
+// 16-bit INC/DEC -- INC rp[p] / DEC rp[p]
+#define DEFINE_INC_DEC_RP(rp)											\
+	static int8_t op_INC16_##rp(state* st, memory* mem, uint16_t imm) {	\
+		DEBUG_OPCODES("INC " #rp "\n");									\
+		set_##rp(st, get_##rp(st) + 1);									\
+		return 0;														\
+	}																	\
+	static int8_t op_DEC16_##rp(state* st, memory* mem, uint16_t imm) {	\
+		DEBUG_OPCODES("DEC " #rp "\n");									\
+		set_##rp(st, get_##rp(st) - 1);									\
+		return 0;														\
+	}
+
+#define FOR_EACH_RP(M) M(BC) M(DE) M(HL) M(SP)
+
+FOR_EACH_RP(DEFINE_LD_RP_NN)
+FOR_EACH_RP(DEFINE_ADD_HL_RP)
+FOR_EACH_RP(DEFINE_INC_DEC_RP)
 
-	return -1;
+// Indirect loading
+// LD (BC), A
+static int8_t op_LD_BC_A(state* st, memory* mem, uint16_t imm) {
+	DEBUG_OPCODES("LD (BC), A\n");
+	memory_write_byte(mem, get_BC(st), st->reg.A);
+	return 0;
 }
 
-// Select register using register pairs table
-static void resolve_register_pairs(state *st, uint8_t p, uint8_t **first, uint8_t **second) {
-	switch(p) {
-	case 0:
-		*first = &(st->reg.B);
-		*second = &(st->reg.C);
-		break;
-	case 1:
-		*first = &(st->reg.D);
-		*second = &(st->reg.E);
-		break;
-	case 2:
-		*first = &(st->reg.H);
-		*second = &(st->reg.L);
-		break;
-	case 3:
-		// Trick for SP to fit, suppose little-endianness
-		*second = (uint8_t*)(&(st->reg.SP));
-		*first = (uint8_t*)(&(st->reg.SP)) + sizeof(uint8_t);
-		break;
-	default:
-		ERROR("Unknown register pairs with p = %d\n", p);
-	}
+// LD (DE), A
+static int8_t op_LD_DE_A(state* st, memory* mem, uint16_t imm) {
+	DEBUG_OPCODES("LD (DE), A\n");
+	memory_write_byte(mem, get_DE(st), st->reg.A);
+	return 0;
 }
 
-#ifndef NDEBUG_OPCODES
-static const char* resolve_register_pairs_name(uint8_t p) {
-	switch(p) {
-	case 0:
-		return "BC";
-	case 1:
-		return "DE";
-	case 2:
-		return "HL";
-	case 3:
-		return "SP";
-	default:
-		return "??";
-	}
-}
-#endif
-
-// Select register using register pairs table version 2
-static void resolve_register_pairs_v2(state *st, uint8_t p, uint8_t **first, uint8_t **second) {
-	switch(p) {
-	case 0:
-		*first = &(st->reg.B);
-		*second = &(st->reg.C);
-		break;
-	case 1:
-		*first = &(st->reg.D);
-		*second = &(st->reg.E);
-		break;
-	case 2:
-		*first = &(st->reg.H);
-		*second = &(st->reg.L);
-		break;
-	case 3:
-		*first = &(st->reg.A);
-		*second = &(st->reg.F);
-		break;
-	default:
-		ERROR("Unknown register pairs v2 with p = %d\n", p);
-	}
+// LDI (HL), A
+static int8_t op_LDI_HL_A(state* st, memory* mem, uint16_t imm) {
+	DEBUG_OPCODES("LDI (HL), A\n");
+	uint16_t hl = get_HL(st);
+	memory_write_byte(mem, hl, st->reg.A);
+	set_HL(st, hl + 1);
+	return 0;
 }
 
-#ifndef NDEBUG_OPCODES
-static const char* resolve_register_pairs_v2_name(uint8_t p) {
-	switch(p) {
-	case 0:
-		return "BC";
-	case 1:
-		return "DE";
-	case 2:
-		return "HL";
-	case 3:
-		return "AF";
-	default:
-		return "??";
-	}
+// LDD (HL), A
+static int8_t op_LDD_HL_A(state* st, memory* mem, uint16_t imm) {
+	DEBUG_OPCODES("LDD (HL), A\n");
+	uint16_t hl = get_HL(st);
+	memory_write_byte(mem, hl, st->reg.A);
+	set_HL(st, hl - 1);
+	return 0;
 }
-#endif
-
-// 16-bit load immediate/add
-static int8_t handle_no_extra_x_0_z_1(uint8_t y, uint8_t z, uint8_t p, uint8_t q, state* st, memory* mem) {
-	uint8_t *first = NULL;
-	uint8_t *second = NULL;
-	resolve_register_pairs(st, p, &first, &second);
-
-	// LD rp[p], nn
-	if (q == 0) {
-		*second = memory_read_byte(mem, st->reg.PC);
-		st->reg.PC++;
-		*first = memory_read_byte(mem, st->reg.PC);
-		st->reg.PC++;
-
-		DEBUG_OPCODES("LD %s, %X\n", resolve_register_pairs_name(p), (*first << 8) + *second);
-
-		return 3;
-    // ADD HL, rp[p]
-	} else {
-		DEBUG_OPCODES("ADD HL, %s\n", resolve_register_pairs_name(p));
 
-		uint16_t hl = (st->reg.H << 8) + st->reg.L;
-		uint16_t pr = (*first << 8) + *second;
-		uint32_t res = hl + pr;
-
-		if ((hl & 0xFFF) > (res & 0xFFF))
-			st->reg.F |= FLAG_HALF_CARRY;
-		else
-			st->reg.F &= ~FLAG_HALF_CARRY;
-
-		if (res > 0xFFFF)
-			st->reg.F |= FLAG_CARRY;
-		else
-			st->reg.F &= ~FLAG_CARRY;
-
-		st->reg.F &= ~FLAG_SUBSTRACTION;
-
-		st->reg.H = (res >> 8) & 0xFF;
-		st->reg.L = (res & 0xFF);
-		return 2;
-	}
+// LD A, (BC)
+static int8_t op_LD_A_BC(state* st, memory* mem, uint16_t imm) {
+	DEBUG_OPCODES("LD A, (BC)\n");
+	st->reg.A = memory_read_byte(mem, get_BC(st));
+	return 0;
 }
 
-// Indirect loading
-static int8_t handle_no_extra_x_0_z_2(uint8_t y, uint8_t z, uint8_t p, uint8_t q, state* st, memory* mem) {
-	switch((q << 2) + p) {
-		// LD (BC), A
-	case 0:
-		DEBUG_OPCODES("ADD (BC), A\n");
-
-		memory_write_byte(mem, (st->reg.B << 8) + st->reg.C, st->reg.A);
-		return 2;
-		// LD (DE), A
-	case 1:
-		DEBUG_OPCODES("LD (DE), A\n");
+// LD A, (DE)
+static int8_t op_LD_A_DE(state* st, memory* mem, uint16_t imm) {
+	DEBUG_OPCODES("LD A, (DE)\n");
+	st->reg.A = memory_read_byte(mem, get_DE(st));
+	return 0;
+}
 
-		memory_write_byte(mem, (st->reg.D << 8) + st->reg.E, st->reg.A);
-		return 2;
-		// LDI (HL), A
-	case 2:
-	{
-		DEBUG_OPCODES("LDI (HL), A\n");
+// LDI A, (HL)
+static int8_t op_LDI_A_HL(state* st, memory* mem, uint16_t imm) {
+	DEBUG_OPCODES("LDI A, (HL)\n");
+	uint16_t hl = get_HL(st);
+	st->reg.A = memory_read_byte(mem, hl);
+	set_HL(st, hl + 1);
+	return 0;
+}
 
-		uint16_t hl = (st->reg.H << 8) + st->reg.L;
-		memory_write_byte(mem, hl, st->reg.A);
-		hl++;
-		st->reg.H = hl >> 8;
-		st->reg.L = hl;
+// LDD A, (HL)
+static int8_t op_LDD_A_HL(state* st, memory* mem, uint16_t imm) {
+	DEBUG_OPCODES("LDD A, (HL)\n");
+	uint16_t hl = get_HL(st);
+	st->reg.A = memory_read_byte(mem, hl);
+	set_HL(st, hl - 1);
+	return 0;
+}
 
-		return 2;
+// 8-bit INC -- INC r[y]
+#define DEFINE_INC_R(unused, r)											\
+	static int8_t op_INC_##r(state* st, memory* mem, uint16_t imm) {	\
+		DEBUG_OPCODES("INC %s\n", NAME_##r);							\
+		uint8_t v = LOAD_##r(st, mem) + 1;								\
+		st->reg.F &= FLAG_CARRY;										\
+		if (v == 0)														\
+			st->reg.F |= FLAG_ZERO;										\
+		if ((v & 0xF) == 0)												\
+			st->reg.F |= FLAG_HALF_CARRY;								\
+		STORE_##r(st, mem, v);											\
+		return 0;														\
+	}
+
+// 8-bit DEC -- DEC r[y]
+#define DEFINE_DEC_R(unused, r)											\
+	static int8_t op_DEC_##r(state* st, memory* mem, uint16_t imm) {	\
+		DEBUG_OPCODES("DEC %s\n", NAME_##r);							\
+		uint8_t v = LOAD_##r(st, mem) - 1;								\
+		st->reg.F &= FLAG_CARRY;										\
+		st->reg.F |= FLAG_SUBSTRACTION;									\
+		if (v == 0)														\
+			st->reg.F |= FLAG_ZERO;										\
+		if ((v & 0xF) == 0xF)											\
+			st->reg.F |= FLAG_HALF_CARRY;								\
+		STORE_##r(st, mem, v);											\
+		return 0;														\
 	}
-		// LDD (HL), A
-	case 3:
-	{
-		DEBUG_OPCODES("LDD (HL), A\n");
-		uint16_t hl = (st->reg.H << 8) + st->reg.L;
-		memory_write_byte(mem, hl, st->reg.A);
-		hl--;
-		st->reg.H = hl >> 8;
-		st->reg.L = hl;
 
-		return 2;
+// 8-bit load immediate -- LD r[y], nn
+#define DEFINE_LD_R_N(unused, r)										\
+	static int8_t op_LD_##r##_n(state* st, memory* mem, uint16_t imm) {	\
+		DEBUG_OPCODES("LD %s, %X\n", NAME_##r, imm);					\
+		STORE_##r(st, mem, imm);										\
+		return 0;														\
 	}
-		// LD A, (BC)
-	case 4:
-		DEBUG_OPCODES("LD A, (BC)\n");
 
-		st->reg.A = memory_read_byte(mem, (st->reg.B << 8) + st->reg.C);
-		return 2;
-		// LD A, (DE)
-	case 5:
-		DEBUG_OPCODES("LD A, (DE)\n");
-
-		st->reg.A = memory_read_byte(mem, (st->reg.D << 8) + st->reg.E);
-		return 2;
-		// LDI A, (HL)
-	case 6:
-	{
-		DEBUG_OPCODES("LDI A, (HL)\n");
+FOR_EACH_OPERAND(DEFINE_INC_R, _)
+FOR_EACH_OPERAND(DEFINE_DEC_R, _)
+FOR_EACH_OPERAND(DEFINE_LD_R_N, _)
 
-		uint16_t hl = (st->reg.H << 8) + st->reg.L;
-		st->reg.A = memory_read_byte(mem, hl);
-		hl++;
-		st->reg.H = hl >> 8;
-		st->reg.L = hl;
+// Assorted operations on accumulator/flags
+// RLCA
+static int8_t op_RLCA(state* st, memory* mem, uint16_t imm) {
+	DEBUG_OPCODES("RLCA\n");
 
-		return 2;
-	}
-		// LDD A, (HL)
-	case 7:
-	{
-		DEBUG_OPCODES("LDD A, (HL)\n");
+	uint8_t new = st->reg.A << 1 | st->reg.A >> 7;
 
-		uint16_t hl = (st->reg.H << 8) + st->reg.L;
-		st->reg.A = memory_read_byte(mem, hl);
-		hl--;
-		st->reg.H = hl >> 8;
-		st->reg.L = hl;
+	st->reg.F = FLAG_NONE;
 
-		return 2;
-	}
-	}
+	if (st->reg.A > 0x7F)
+		st->reg.F |= FLAG_CARRY;
 
-	return -1;
+	st->reg.A = new;
+	return 0;
 }
 
-// 16-bit INC/DEC
-static int8_t handle_no_extra_x_0_z_3(uint8_t y, uint8_t z, uint8_t p, uint8_t q, state* st, memory* mem) {
-	uint8_t *first = NULL;
-	uint8_t *second = NULL;
-	resolve_register_pairs(st, p, &first, &second);
+// RRCA
+static int8_t op_RRCA(state* st, memory* mem, uint16_t imm) {
+	DEBUG_OPCODES("RRCA\n");
 
-	uint16_t total = (*first << 8) + *second;
+	uint8_t new = st->reg.A >> 1 | st->reg.A << 7;
 
+	st->reg.F = FLAG_NONE;
 
-	// INC rp[p]
-	if (q == 0) {
-		DEBUG_OPCODES("INC %s\n", resolve_register_pairs_name(p));
-		total++;
-	}
-	// DEC rp[p]
-	else {
-		total--;
-		DEBUG_OPCODES("DEC %s\n", resolve_register_pairs_name(p));
-	}
-
-	*first = total >> 8;
-	*second = total;
+	if (new > 0x7F)
+		st->reg.F |= FLAG_CARRY;
 
-	return 2;
+	st->reg.A = new;
+	return 0;
 }
 
-// 8-bit INC
-static int8_t handle_no_extra_x_0_z_4(uint8_t y, uint8_t z, uint8_t p, uint8_t q, state* st, memory* mem) {
-	uint8_t *reg = resolve_register(y, st);
+// RLA
+static int8_t op_RLA(state* st, memory* mem, uint16_t imm) {
+	DEBUG_OPCODES("RLA\n");
 
-	DEBUG_OPCODES("INC %s\n", resolve_register_name(y));
+	uint8_t new = st->reg.A << 1;
 
-	// Get data from memory for (HL)
-	uint8_t is_hl = reg == NULL;
-	uint8_t hl_value = 0;
-	if (is_hl) {
-		hl_value = memory_read_byte(mem, (st->reg.H << 8) + st->reg.L);
-		reg = &hl_value;
-	}
-
-	*reg += 1;
+	if (st->reg.F & FLAG_CARRY)
+		new += 1;
 
-	// Handle flags
-	if (*reg == 0)
-		st->reg.F |= FLAG_ZERO;
-	else
-		st->reg.F &= ~FLAG_ZERO;
+	st->reg.F = FLAG_NONE;
 
-	if ((*reg & 0xF) == 0)
-		st->reg.F |= FLAG_HALF_CARRY;
-	else
-		st->reg.F &= ~FLAG_HALF_CARRY;
-
-	st->reg.F &= ~FLAG_SUBSTRACTION;
-
-	if (is_hl) {
-		memory_write_byte(mem, (st->reg.H << 8) + st->reg.L, *reg);
-		return 3;
-	} else {
-		return 1;
-	}
+	if (st->reg.A > 0x7F)
+		st->reg.F |= FLAG_CARRY;
 
-	return 1;
+	st->reg.A = new;
+	return 0;
 }
 
-// 8-bit DEC
-static int8_t handle_no_extra_x_0_z_5(uint8_t y, uint8_t z, uint8_t p, uint8_t q, state* st, memory* mem) {
-	uint8_t *reg = resolve_register(y, st);
-
-	DEBUG_OPCODES("DEC %s\n", resolve_register_name(y));
+// RRA
+static int8_t op_RRA(state* st, memory* mem, uint16_t imm) {
+	DEBUG_OPCODES("RRA\n");
 
-	// Get data from memory for (HL)
-	uint8_t is_hl = reg == NULL;
-	uint8_t hl_value = 0;
-	if (is_hl) {
-		hl_value = memory_read_byte(mem, (st->reg.H << 8) + st->reg.L);
-		reg = &hl_value;
-	}
+	uint8_t new = st->reg.A >> 1;
 
-	*reg -= 1;
+	if (st->reg.F & FLAG_CARRY)
+		new |= 0x80;
 
-	// Handle flags
-	if (*reg == 0)
-		st->reg.F |= FLAG_ZERO;
-	else
-		st->reg.F &= ~FLAG_ZERO;
+	st->reg.F = FLAG_NONE;
 
-	if ((*reg & 0xF) == 0xF)
-		st->reg.F |= FLAG_HALF_CARRY;
-	else
-		st->reg.F &= ~FLAG_HALF_CARRY;
-
-	st->reg.F |= FLAG_SUBSTRACTION;
-
-	if (is_hl) {
-		memory_write_byte(mem, (st->reg.H << 8) + st->reg.L, *reg);
-		return 3;
-	} else {
-		return 1;
-	}
+	if (st->reg.A & 1)
+		st->reg.F |= FLAG_CARRY;
 
-	return 1;
+	st->reg.A = new;
+	return 0;
 }
 
-// 8-bit load immediate -- LD r[y], nn
-static int8_t handle_no_extra_x_0_z_6(uint8_t y, uint8_t z, uint8_t p, uint8_t q, state* st, memory* mem) {
-	uint8_t *reg = resolve_register(y, st);
-
-	// Get data from memory for (HL)
-	uint8_t is_hl = reg == NULL;
-	uint8_t hl_value = 0;
-	if (is_hl) {
-		hl_value = memory_read_byte(mem, (st->reg.H << 8) + st->reg.L);
-		reg = &hl_value;
-	}
-
-	uint8_t im = memory_read_byte(mem, st->reg.PC);
-	st->reg.PC++;
+// DAA
+// This one from https://github.com/drhelius/Gearboy/blob/2c488db2ab9a87ff9e36812de115d79b23496d53/src/opcodes.cpp#L303
+static int8_t op_DAA(state* st, memory* mem, uint16_t imm) {
+	DEBUG_OPCODES("DAA\n");
 
-	DEBUG_OPCODES("LD %s, %X\n", resolve_register_name(y), im);
+	int16_t a = st->reg.A;
 
-	*reg = im;
+	if ((st->reg.F & FLAG_SUBSTRACTION) == 0) {
+		if (((st->reg.F & FLAG_HALF_CARRY) != 0) || (a & 0xF) > 0x9)
+			a += 0x06;
 
-	if (is_hl) {
-		memory_write_byte(mem, (st->reg.H << 8) + st->reg.L, *reg);
-		return 3;
+		if (((st->reg.F & FLAG_CARRY) != 0) || a > 0x9F)
+			a += 0x60;
 	}
+	else {
+		if ((st->reg.F & FLAG_HALF_CARRY) != 0)
+			a = (a - 6) & 0xFF;
 
-	return 2;
-}
-
-// Assorted operations on accumulator/flags
-static int8_t handle_no_extra_x_0_z_7(uint8_t y, uint8_t z, uint8_t p, uint8_t q, state* st, memory* mem) {
-	switch (y) {
-		// RLCA
-	case 0:
-	{
-		DEBUG_OPCODES("RLCA\n");
-
-		uint8_t new = st->reg.A << 1 | st->reg.A >> 7;
-
-		st->reg.F = FLAG_NONE;
-
-		if (st->reg.A > 0x7F)
-			st->reg.F |= FLAG_CARRY;
-
-		st->reg.A = new;
-		break;
+		if ((st->reg.F & FLAG_CARRY) != 0)
+			a -= 0x60;
 	}
-		// RRCA
-	case 1:
-	{
-		DEBUG_OPCODES("RRCA\n");
 
-		uint8_t new = st->reg.A >> 1 | st->reg.A << 7;
+	st->reg.F &= ~FLAG_HALF_CARRY;
+	st->reg.F &= ~FLAG_ZERO;
 
-		st->reg.F = FLAG_NONE;
+	if (a & 0x100)
+		st->reg.F |= FLAG_CARRY;
 
-		if (new > 0x7F)
-			st->reg.F |= FLAG_CARRY;
+	st->reg.A = a & 0xFF;
 
-		st->reg.A = new;
-		break;
-	}
-		// RLA
-	case 2:
-	{
-		DEBUG_OPCODES("RLA\n");
+	if (st->reg.A == 0)
+		st->reg.F |= FLAG_ZERO;
 
-		uint8_t new = st->reg.A << 1;
+	return 0;
+}
 
-		if (st->reg.F & FLAG_CARRY)
-			new += 1;
+// CPL
+static int8_t op_CPL(state* st, memory* mem, uint16_t imm) {
+	DEBUG_OPCODES("CPL\n");
 
-		st->reg.F = FLAG_NONE;
+	st->reg.A = ~(st->reg.A);
+	st->reg.F |= FLAG_SUBSTRACTION;
+	st->reg.F |= FLAG_HALF_CARRY;
+	return 0;
+}
 
-		if (st->reg.A > 0x7F)
-			st->reg.F |= FLAG_CARRY;
+// SCF
+static int8_t op_SCF(state* st, memory* mem, uint16_t imm) {
+	DEBUG_OPCODES("SCF\n");
 
-		st->reg.A = new;
-		break;
-	}
-		// RRA
-	case 3:
-	{
-		DEBUG_OPCODES("RRA\n");
+	st->reg.F |= FLAG_CARRY;
+	st->reg.F &= ~FLAG_SUBSTRACTION;
+	st->reg.F &= ~FLAG_HALF_CARRY;
+	return 0;
+}
 
-		uint8_t new = st->reg.A >> 1;
+// CCF
+static int8_t op_CCF(state* st, memory* mem, uint16_t imm) {
+	DEBUG_OPCODES("CCF\n");
 
-		if (st->reg.F & FLAG_CARRY)
-			new |= 0x80;
+	st->reg.F = st->reg.F ^ FLAG_CARRY;
+	st->reg.F &= ~FLAG_SUBSTRACTION;
+	st->reg.F &= ~FLAG_HALF_CARRY;
+	return 0;
+}
 
-		st->reg.F = FLAG_NONE;
+/******************************************************************************
+ * x = 1
+ ******************************************************************************/
 
-		if (st->reg.A & 1)
-			st->reg.F |= FLAG_CARRY;
+// Load reg_src into reg_dst -- LD r[y], r[z]
+#define DEFINE_LD_R_R(dst, src)													\
+	static int8_t op_LD_##dst##_##src(state* st, memory* mem, uint16_t imm) {	\
+		DEBUG_OPCODES("LD %s, %s\n", NAME_##dst, NAME_##src);					\
+		STORE_##dst(st, mem, LOAD_##src(st, mem));								\
+		return 0;																\
+	}
+
+// LD (HL), (HL) is replaced by HALT
+#define DEFINE_LD_R(unused, dst)										\
+	DEFINE_LD_R_R(dst, B) DEFINE_LD_R_R(dst, C)							\
+	DEFINE_LD_R_R(dst, D) DEFINE_LD_R_R(dst, E)							\
+	DEFINE_LD_R_R(dst, H) DEFINE_LD_R_R(dst, L)							\
+	DEFINE_LD_R_R(dst, A)
+
+FOR_EACH_OPERAND(DEFINE_LD_R, _)
+DEFINE_LD_R_R(B, HL)
+DEFINE_LD_R_R(C, HL)
+DEFINE_LD_R_R(D, HL)
+DEFINE_LD_R_R(E, HL)
+DEFINE_LD_R_R(H, HL)
+DEFINE_LD_R_R(L, HL)
+DEFINE_LD_R_R(A, HL)
+
+// HALT
+static int8_t op_HALT(state* st, memory* mem, uint16_t imm) {
+	DEBUG_OPCODES("HALT\n");
+
+	// With interrupts disabled and one already pending, HALT exits at once
+	// and the next opcode byte is read twice
+	if (!st->irq_master && interrupts_pending(mem->ir))
+		st->halt_bug = 1;
+	else
+		st->halt_mode = 1;
 
-		st->reg.A = new;
-		break;
-	}
-		// DAA
-		// This one from https://github.com/drhelius/Gearboy/blob/2c488db2ab9a87ff9e36812de115d79b23496d53/src/opcodes.cpp#L303
-	case 4:
-	{
-		DEBUG_OPCODES("DAA\n");
+	return 0;
+}
 
- 		int16_t a = st->reg.A;
+/******************************************************************************
+ * x = 2 (and x = 3, z = 6 for immediate operand)
+ ******************************************************************************/
 
-		if ((st->reg.F & FLAG_SUBSTRACTION) == 0) {
-			if (((st->reg.F & FLAG_HALF_CARRY) != 0) || (a & 0xF) > 0x9)
-				a += 0x06;
+// Accumulator arithmetic, shared between register and immediate operands
+static inline void alu_ADD(state* st, uint8_t val) {
+	uint16_t bound = st->reg.A + val;
 
-			if (((st->reg.F & FLAG_CARRY) != 0) || a > 0x9F)
-				a += 0x60;
-		}
-		else {
-			if ((st->reg.F & FLAG_HALF_CARRY) != 0)
-				a = (a - 6) & 0xFF;
+	st->reg.F = FLAG_NONE;
 
-			if ((st->reg.F & FLAG_CARRY) != 0)
-				a -= 0x60;
-		}
+	if ((bound & 0xF) < (st->reg.A & 0xF))
+		st->reg.F |= FLAG_HALF_CARRY;
 
-		st->reg.F &= ~FLAG_HALF_CARRY;
-		st->reg.F &= ~FLAG_ZERO;
+	if (bound > 0xFF)
+		st->reg.F |= FLAG_CARRY;
 
-		if (a & 0x100)
-			st->reg.F |= FLAG_CARRY;
+	st->reg.A = (uint8_t)bound;
 
-		st->reg.A = a & 0xFF;
+	if (st->reg.A == 0)
+		st->reg.F |= FLAG_ZERO;
+}
 
-		if (st->reg.A == 0)
-			st->reg.F |= FLAG_ZERO;
+static inline void alu_ADC(state* st, uint8_t val) {
+	uint8_t flag = ((st->reg.F & FLAG_CARRY) ? 1 : 0);
+	int16_t bound = st->reg.A + val + flag;
 
-		break;
-	}
-		// CPL
-	case 5:
-		DEBUG_OPCODES("CPL\n");
+	st->reg.F = FLAG_NONE;
 
-		st->reg.A = ~(st->reg.A);
-		st->reg.F |= FLAG_SUBSTRACTION;
+	if ((st->reg.A & 0xF) + (val & 0xF) + flag > 0xF)
 		st->reg.F |= FLAG_HALF_CARRY;
 
-		break;
-		// SCF
-	case 6:
-		DEBUG_OPCODES("SCF\n");
-
+	if (bound > 0xFF)
 		st->reg.F |= FLAG_CARRY;
-		st->reg.F &= ~FLAG_SUBSTRACTION;
-		st->reg.F &= ~FLAG_HALF_CARRY;
-		break;
-
-		// CCF
-	case 7:
-		DEBUG_OPCODES("CCF\n");
-
-		st->reg.F = st->reg.F ^ FLAG_CARRY;
-		st->reg.F &= ~FLAG_SUBSTRACTION;
-		st->reg.F &= ~FLAG_HALF_CARRY;
-		break;
-	}
 
-	return 1;
-}
-
-static int8_t handle_no_extra_x_0(uint8_t y, uint8_t z, uint8_t p, uint8_t q, state* st, memory* mem) {
-	switch (z) {
-	case 0:
-		return handle_no_extra_x_0_z_0(y, z, p, q, st, mem);
-	case 1:
-		return handle_no_extra_x_0_z_1(y, z, p, q, st, mem);
-	case 2:
-		return handle_no_extra_x_0_z_2(y, z, p, q, st, mem);
-	case 3:
-		return handle_no_extra_x_0_z_3(y, z, p, q, st, mem);
-	case 4:
-		return handle_no_extra_x_0_z_4(y, z, p, q, st, mem);
-	case 5:
-		return handle_no_extra_x_0_z_5(y, z, p, q, st, mem);
-	case 6:
-		return handle_no_extra_x_0_z_6(y, z, p, q, st, mem);
-	case 7:
-		return handle_no_extra_x_0_z_7(y, z, p, q, st, mem);
-	}
+	st->reg.A = (uint8_t)bound;
 
-	return -1;
+	if (st->reg.A == 0)
+		st->reg.F |= FLAG_ZERO;
 }
 
-// Load reg_src into reg_dst -- LD r[y], r[z]
-static int8_t handle_no_extra_x_1(uint8_t y, uint8_t z, uint8_t p, uint8_t q, state* st, memory* mem) {
-	uint8_t* reg_dst = resolve_register(y, st);
-	uint8_t* reg_src = resolve_register(z, st);
-
-	// Get data from memory for (HL)
-	uint8_t is_hl_dst = reg_dst == NULL;
-	uint8_t is_hl_src = reg_src == NULL;
-	uint8_t hl_value = 0;
-
-	// Special case of HALT instruction -- replace LD (HL), (HL)
-	if (is_hl_dst && is_hl_src) {
-		DEBUG_OPCODES("HALT\n");
+static inline void alu_SUB(state* st, uint8_t val) {
+	int16_t bound = st->reg.A - val;
 
-		WARN("HALT instruction, not handled yet.\n");
-		return 1;
-	}
-
-	DEBUG_OPCODES("LD %s, %s\n", resolve_register_name(y), resolve_register_name(z));
+	st->reg.F = FLAG_SUBSTRACTION;
 
-	if (is_hl_src) {
-		hl_value = memory_read_byte(mem, (st->reg.H << 8) + st->reg.L);
-		reg_src = &hl_value;
-	}
-
-	if (is_hl_dst) {
-		reg_dst = &hl_value;
-	}
+	if ((st->reg.A & 0xF) < (bound & 0xF))
+		st->reg.F |= FLAG_HALF_CARRY;
 
-	*reg_dst = *reg_src;
+	if (bound < 0)
+		st->reg.F |= FLAG_CARRY;
 
-	if (is_hl_dst)
-		memory_write_byte(mem, (st->reg.H << 8) + st->reg.L, *reg_dst);
+	st->reg.A = (uint8_t)bound;
 
-	if (is_hl_src || is_hl_dst)
-		return 2;
-	else
-		return 1;
+	if (st->reg.A == 0)
+		st->reg.F |= FLAG_ZERO;
 }
 
-// Registers arithmetic
-// TODO: refactor
-static int8_t handle_no_extra_x_2(uint8_t y, uint8_t z, uint8_t p, uint8_t q, state* st, memory* mem) {
-	uint8_t* reg = resolve_register(z, st);
-
-	// Get data from memory for (HL)
-	uint8_t is_hl = reg == NULL;
-	uint8_t hl_value = 0;
-	if (is_hl) {
-		hl_value = memory_read_byte(mem, (st->reg.H << 8) + st->reg.L);
-		reg = &hl_value;
-	}
+static inline void alu_SBC(state* st, uint8_t val) {
+	uint8_t flag = (st->reg.F & FLAG_CARRY ? 1 : 0);
+	int16_t bound = st->reg.A - val - flag;
 
-	switch(y) {
-		// ADD A,
-	case 0:
-	{
-		DEBUG_OPCODES("ADD A, %s\n", resolve_register_name(z));
+	st->reg.F = FLAG_SUBSTRACTION;
 
-		uint16_t bound = st->reg.A + *reg;
-
-		st->reg.F = FLAG_NONE;
+	if (bound < 0)
+		st->reg.F |= FLAG_CARRY;
 
-		if ((bound & 0xF) < (st->reg.A & 0xF))
-			st->reg.F |= FLAG_HALF_CARRY;
+	if ((st->reg.A & 0xF) - (val & 0xF) - flag < 0)
+		st->reg.F |= FLAG_HALF_CARRY;
 
-		if (bound > 0xFF)
-			st->reg.F |= FLAG_CARRY;
+	st->reg.A = (uint8_t)bound;
 
-		st->reg.A = (uint8_t)bound;
+	if (st->reg.A == 0)
+		st->reg.F |= FLAG_ZERO;
+}
 
-		if (st->reg.A == 0)
-			st->reg.F |= FLAG_ZERO;
+static inline void alu_AND(state* st, uint8_t val) {
+	st->reg.A &= val;
+	st->reg.F = FLAG_HALF_CARRY;
+	if (st->reg.A == 0)
+		st->reg.F |= FLAG_ZERO;
+}
 
-		break;
-	}
-		// ADC A,
-	case 1:
-	{
-		DEBUG_OPCODES("ADC A, %s\n", resolve_register_name(z));
+static inline void alu_XOR(state* st, uint8_t val) {
+	st->reg.A ^= val;
+	st->reg.F = FLAG_NONE;
+	if (st->reg.A == 0)
+		st->reg.F |= FLAG_ZERO;
+}
 
-		uint8_t flag = ((st->reg.F & FLAG_CARRY) ? 1 : 0);
-		int16_t bound = st->reg.A + *reg + flag;
+static inline void alu_OR(state* st, uint8_t val) {
+	st->reg.A |= val;
+	st->reg.F = FLAG_NONE;
+	if (st->reg.A == 0)
+		st->reg.F |= FLAG_ZERO;
+}
 
-		st->reg.F = FLAG_NONE;
+static inline void alu_CP(state* st, uint8_t val) {
+	int16_t bound = st->reg.A - val;
 
-		if ((st->reg.A & 0xF) + (*reg & 0xF) + flag > 0xF)
-			st->reg.F |= FLAG_HALF_CARRY;
+	st->reg.F = FLAG_SUBSTRACTION;
 
-		if (bound > 0xFF)
-			st->reg.F |= FLAG_CARRY;
+	if ((bound & 0xF) > (st->reg.A & 0xF))
+		st->reg.F |= FLAG_HALF_CARRY;
 
-		st->reg.A = (uint8_t)bound;
+	if (bound < 0)
+		st->reg.F |= FLAG_CARRY;
 
-		if (st->reg.A == 0)
-			st->reg.F |= FLAG_ZERO;
+	if ((uint8_t)bound == 0)
+		st->reg.F |= FLAG_ZERO;
+}
 
-		break;
+// alu[y] r[z]
+#define DEFINE_ALU_R(alu, r)												\
+	static int8_t op_##alu##_##r(state* st, memory* mem, uint16_t imm) {	\
+		DEBUG_OPCODES(#alu " A, %s\n", NAME_##r);							\
+		alu_##alu(st, LOAD_##r(st, mem));									\
+		return 0;															\
 	}
-		// SUB
-	case 2:
-	{
-		DEBUG_OPCODES("SUB A, %s\n", resolve_register_name(z));
 
-		int16_t bound = st->reg.A - *reg;
-
-		st->reg.F = FLAG_SUBSTRACTION;
-
-		if ((st->reg.A & 0xF) < (bound & 0xF))
-			st->reg.F |= FLAG_HALF_CARRY;
-
-		if (bound < 0)
-			st->reg.F |= FLAG_CARRY;
-
-		st->reg.A = (uint8_t)bound;
-
-		if (st->reg.A == 0)
-			st->reg.F |= FLAG_ZERO;
-
-		break;
+// alu[y] n
+#define DEFINE_ALU_N(alu)												\
+	static int8_t op_##alu##_n(state* st, memory* mem, uint16_t imm) {	\
+		DEBUG_OPCODES(#alu " A, %x\n", imm);							\
+		alu_##alu(st, imm);												\
+		return 0;														\
 	}
-		// SBC A,
-	case 3:
-	{
-		DEBUG_OPCODES("SBC A, %s\n", resolve_register_name(z));
 
-		uint8_t flag = (st->reg.F & FLAG_CARRY ? 1 : 0);
-		int16_t bound = st->reg.A - *reg - flag;
+#define FOR_EACH_ALU(M)													\
+	M(ADD) M(ADC) M(SUB) M(SBC) M(AND) M(XOR) M(OR) M(CP)
 
-		st->reg.F = FLAG_SUBSTRACTION;
+#define DEFINE_ALU(alu) FOR_EACH_OPERAND(DEFINE_ALU_R, alu) DEFINE_ALU_N(alu)
 
-		if (bound < 0)
-			st->reg.F |= FLAG_CARRY;
+FOR_EACH_ALU(DEFINE_ALU)
 
-		if ((st->reg.A & 0xF) - (*reg & 0xF) - flag < 0)
-			st->reg.F |= FLAG_HALF_CARRY;
+/******************************************************************************
+ * x = 3
+ ******************************************************************************/
 
-		st->reg.A = (uint8_t)bound;
-
-		if (st->reg.A == 0)
-			st->reg.F |= FLAG_ZERO;
-
-		break;
+// Conditionnal return -- RET cc[y]
+#define DEFINE_RET_CC(cc)												\
+	static int8_t op_RET_##cc(state* st, memory* mem, uint16_t imm) {	\
+		DEBUG_OPCODES("RET " #cc "\n");									\
+		if (COND_##cc(st)) {											\
+			st->reg.PC = memory_read_word(mem, st->reg.SP);				\
+			st->reg.SP += 2;											\
+			return 3;													\
+		}																\
+		return 0;														\
 	}
-		// AND
-	case 4:
-		DEBUG_OPCODES("AND A, %s\n", resolve_register_name(z));
 
-		st->reg.A &= *reg;
-		st->reg.F = FLAG_NONE;
-		st->reg.F |= FLAG_HALF_CARRY;
-		if (st->reg.A == 0)
-			st->reg.F |= FLAG_ZERO;
-
-		break;
-		// XOR
-	case 5:
-		DEBUG_OPCODES("XOR A, %s\n", resolve_register_name(z));
-		st->reg.A ^= *reg;
-		st->reg.F = FLAG_NONE;
-		if (st->reg.A == 0)
-			st->reg.F |= FLAG_ZERO;
-
-		break;
-		// OR
-	case 6:
-		DEBUG_OPCODES("OR A, %s\n", resolve_register_name(z));
-
-		st->reg.A |= *reg;
-		st->reg.F = FLAG_NONE;
-		if (st->reg.A == 0)
-			st->reg.F |= FLAG_ZERO;
-		break;
-		// CP
-	case 7:
-	{
-		DEBUG_OPCODES("CP A, %s\n", resolve_register_name(z));
-
-		int16_t bound = st->reg.A - *reg;
-		uint8_t i = 0;
-		st->reg.F = FLAG_SUBSTRACTION;
-
-		if ((bound & 0xF) > (st->reg.A & 0xF))
-			st->reg.F |= FLAG_HALF_CARRY;
-
-		if (bound < 0)
-			st->reg.F |= FLAG_CARRY;
-
-		i = (uint8_t)bound;
-
-		if (i == 0)
-			st->reg.F |= FLAG_ZERO;
-
-		break;
-	}
+// Conditionnal jump -- JP cc[y], nn
+#define DEFINE_JP_CC(cc)												\
+	static int8_t op_JP_##cc(state* st, memory* mem, uint16_t imm) {	\
+		DEBUG_OPCODES("JP " #cc ", %X\n", imm);							\
+		if (COND_##cc(st)) {											\
+			st->reg.PC = imm;											\
+			return 1;													\
+		}																\
+		return 0;														\
 	}
 
-	if (is_hl)
-		return 2;
-	else
-		return 1;
+// Condtionnal call -- CALL cc[y], nn
+#define DEFINE_CALL_CC(cc)												\
+	static int8_t op_CALL_##cc(state* st, memory* mem, uint16_t imm) {	\
+		DEBUG_OPCODES("CALL " #cc ", %X\n", imm);						\
+		if (COND_##cc(st)) {											\
+			st->reg.SP -= 2;											\
+			memory_write_word(mem, st->reg.SP, st->reg.PC);				\
+			st->reg.PC = imm;											\
+			return 3;													\
+		}																\
+		return 0;														\
+	}
+
+FOR_EACH_COND(DEFINE_RET_CC)
+FOR_EACH_COND(DEFINE_JP_CC)
+FOR_EACH_COND(DEFINE_CALL_CC)
+
+// LD (FF00+n), A
+static int8_t op_LDH_n_A(state* st, memory* mem, uint16_t imm) {
+	uint16_t addr = 0xFF00 + imm;
+	memory_write_byte(mem, addr, st->reg.A);
+	DEBUG_OPCODES("LD (FF00+n=%X), A\n", addr);
+
+	return 0;
 }
 
-// Conditionnal return -- RET cc[y]
-static int8_t handle_no_extra_x_3_z_0(uint8_t y, uint8_t z, uint8_t p, uint8_t q, state* st, memory* mem) {
-	switch(y) {
-		// NZ
-	case 0:
-		DEBUG_OPCODES("RET NZ\n");
-
-		if ((st->reg.F & FLAG_ZERO) == 0) {
-			st->reg.PC = memory_read_word(mem, st->reg.SP);
-			st->reg.SP += sizeof(uint16_t);
-			return 5;
-		}
-
-		return 2;
+// ADD SP, dd
+static int8_t op_ADD_SP_d(state* st, memory* mem, uint16_t imm) {
+	int8_t content = imm;
+	uint32_t tmp = st->reg.SP ^ content ^ (st->reg.SP + content);
+	st->reg.SP += content;
 
-		// Z
-	case 1:
-		DEBUG_OPCODES("RET Z\n");
+	DEBUG_OPCODES("ADD SP, %d\n", content);
 
-		if ((st->reg.F & FLAG_ZERO) != 0) {
-			st->reg.PC = memory_read_word(mem, st->reg.SP);
-			st->reg.SP += sizeof(uint16_t);
-			return 5;
-		}
+	st->reg.F = FLAG_NONE;
 
-		return 2;
-
-		// NC
-	case 2:
-		DEBUG_OPCODES("RET NC\n");
+	if (tmp & 0x100)
+		st->reg.F |= FLAG_CARRY;
 
-		if ((st->reg.F & FLAG_CARRY) == 0) {
-			st->reg.PC = memory_read_word(mem, st->reg.SP);
-			st->reg.SP += sizeof(uint16_t);
-			return 5;
-		}
+	if (tmp & 0x10)
+		st->reg.F |= FLAG_HALF_CARRY;
 
-		return 2;
+	return 0;
+}
 
-		// C
-	case 3:
-		DEBUG_OPCODES("RET C\n");
+// LD A, (FF00+n)
+static int8_t op_LDH_A_n(state* st, memory* mem, uint16_t imm) {
+	uint16_t addr = 0xFF00 + imm;
+	st->reg.A = memory_read_byte(mem, addr);
+	DEBUG_OPCODES("LD A, (FF00+n=%X)\n", addr);
 
-		if ((st->reg.F & FLAG_CARRY) != 0) {
-			st->reg.PC = memory_read_word(mem, st->reg.SP);
-			st->reg.SP += sizeof(uint16_t);
-			return 5;
-		}
+	return 0;
+}
 
-		return 2;
+// LD HL, SP+dd
+static int8_t op_LD_HL_SP_d(state* st, memory* mem, uint16_t imm) {
+	int8_t content = imm;
+	uint16_t dd = st->reg.SP + content;
 
-		// LD (FF00+n), A
-	case 4:
-	{
-		uint16_t addr = 0xFF00 + memory_read_byte(mem, st->reg.PC);
-		st->reg.PC++;
-		memory_write_byte(mem, addr, st->reg.A);
-		DEBUG_OPCODES("LD (FF00+n=%X), A\n", addr);
+	DEBUG_OPCODES("LD HL, SP+dd=%d\n", content);
 
-		return 3;
-	}
-		// ADD SP, dd
-	case 5:
-	{
-		int8_t content = memory_read_byte(mem, st->reg.PC);
-		st->reg.PC++;
-		uint32_t tmp = st->reg.SP ^ content ^ (st->reg.SP + content);
-		st->reg.SP += content;
+	set_HL(st, dd);
 
-		DEBUG_OPCODES("ADD SP, %d\n", content);
+	uint16_t tmp = st->reg.SP ^ content ^ dd;
 
-		st->reg.F = FLAG_NONE;
+	st->reg.F = FLAG_NONE;
 
-		if (tmp & 0x100)
-			st->reg.F |= FLAG_CARRY;
+	if (tmp & 0x100)
+		st->reg.F |= FLAG_CARRY;
 
-		if (tmp & 0x10)
-			st->reg.F |= FLAG_HALF_CARRY;
+	if (tmp & 0x10)
+		st->reg.F |= FLAG_HALF_CARRY;
 
+	return 0;
+}
 
-		return 4;
+// POP rp2[p]
+#define DEFINE_POP(rp)													\
+	static int8_t op_POP_##rp(state* st, memory* mem, uint16_t imm) {	\
+		DEBUG_OPCODES("POP " #rp "\n");									\
+		set_##rp(st, memory_read_word(mem, st->reg.SP));				\
+		st->reg.SP += 2;												\
+		return 0;														\
 	}
-		// LD A, (FF00+n)
-	case 6:
-	{
-		uint16_t addr = 0xFF00 + memory_read_byte(mem, st->reg.PC);
-		st->reg.PC++;
-		st->reg.A = memory_read_byte(mem, addr);
-		DEBUG_OPCODES("LD A, (FF00+n=%X)\n", addr);
 
-		return 3;
+// PUSH rp2[p]
+#define DEFINE_PUSH(rp)													\
+	static int8_t op_PUSH_##rp(state* st, memory* mem, uint16_t imm) {	\
+		DEBUG_OPCODES("PUSH " #rp "\n");								\
+		st->reg.SP -= 2;												\
+		memory_write_word(mem, st->reg.SP, get_##rp(st));				\
+		return 0;														\
 	}
-		// LD HL, SP+dd
-	case 7:
-	{
-		int8_t content = memory_read_byte(mem, st->reg.PC);
-		uint16_t dd = st->reg.SP + content;
-		st->reg.PC++;
-
-		DEBUG_OPCODES("LD HL, SP+dd=%d\n", content);
 
-		st->reg.H = dd >> 8;
-		st->reg.L = dd;
+#define FOR_EACH_RP2(M) M(BC) M(DE) M(HL) M(AF)
 
-		uint16_t tmp = st->reg.SP ^ content ^ dd;
+FOR_EACH_RP2(DEFINE_POP)
+FOR_EACH_RP2(DEFINE_PUSH)
 
-		st->reg.F = FLAG_NONE;
+// RET
+static int8_t op_RET(state* st, memory* mem, uint16_t imm) {
+	DEBUG_OPCODES("RET\n");
 
-		if (tmp & 0x100)
-			st->reg.F |= FLAG_CARRY;
+	st->reg.PC = memory_read_word(mem, st->reg.SP);
+	st->reg.SP += 2;
 
-		if (tmp & 0x10)
-			st->reg.F |= FLAG_HALF_CARRY;
-
-		return 3;
-	}
-	}
-
-	return -1;
+	return 0;
 }
 
-// POP & various ops
-static int8_t handle_no_extra_x_3_z_1(uint8_t y, uint8_t z, uint8_t p, uint8_t q, state* st, memory* mem) {
-	// POP rp2[p]
-	if (q == 0) {
-		uint8_t *first = NULL;
-		uint8_t *second = NULL;
-
-		DEBUG_OPCODES("POP %s\n", resolve_register_pairs_v2_name(p));
-
-		resolve_register_pairs_v2(st, p, &first, &second);
-		*second = memory_read_byte(mem, st->reg.SP);
-		*first = memory_read_byte(mem, st->reg.SP + 1);
-		st->reg.SP += 2;
-		return 3;
-	} else {
-		switch (p) {
-			// RET
-		case 0:
-			DEBUG_OPCODES("RET\n");
+// RETI
+static int8_t op_RETI(state* st, memory* mem, uint16_t imm) {
+	DEBUG_OPCODES("RETI\n");
 
-			st->reg.PC = memory_read_word(mem, st->reg.SP);
-			st->reg.SP += 2;
+	st->reg.PC = memory_read_word(mem, st->reg.SP);
+	st->reg.SP += 2;
+	st->irq_master = 1;
 
-			return 4;
-
-			// RETI
-		case 1:
-			DEBUG_OPCODES("RETI\n");
-
-			st->reg.PC = memory_read_word(mem, st->reg.SP);
-			st->reg.SP += 2;
-			st->irq_master = 1;
-
-			return 4;
-
-			// JP HL
-		case 2:
-			DEBUG_OPCODES("JP HL\n");
-
-			st->reg.PC = (st->reg.H << 8) + st->reg.L;
-			return 1;
-
-			// LD SP, HL
-		case 3:
-			DEBUG_OPCODES("LD SP, HL\n");
-
-			st->reg.SP = (st->reg.H << 8) + st->reg.L;
-			return 2;
-		}
-	}
-
-	return -1;
+	return 0;
 }
 
-// Conditionnal jump -- JP cc[y], nn
-static int8_t handle_no_extra_x_3_z_2(uint8_t y, uint8_t z, uint8_t p, uint8_t q, state* st, memory* mem) {
-	switch(y) {
-		// NZ
-	case 0:
-	{
-		uint16_t addr = memory_read_word(mem, st->reg.PC);
-		DEBUG_OPCODES("JP NZ, %X\n", addr);
-
-		if ((st->reg.F & FLAG_ZERO) == 0) {
-			DEBUG_OPCODES("Jump taken\n");
-			st->reg.PC = addr;
-			return 4;
-		} else {
-			st->reg.PC += 2;
-		}
-
-		return 3;
-	}
-		// Z
-	case 1:
-	{
-		uint16_t addr = memory_read_word(mem, st->reg.PC);
-		DEBUG_OPCODES("JP Z, %X\n", addr);
-		if ((st->reg.F & FLAG_ZERO) != 0) {
-			st->reg.PC = addr;
-			return 4;
-		} else {
-			st->reg.PC += 2;
-		}
-
-		return 3;
-	}
-		// NC
-	case 2:
-	{
-		uint16_t addr = memory_read_word(mem, st->reg.PC);
-		DEBUG_OPCODES("JP NC, %X\n", addr);
-		if ((st->reg.F & FLAG_CARRY) == 0) {
-			st->reg.PC = addr;
-			return 4;
-		} else {
-			st->reg.PC += 2;
-		}
-
-		return 3;
-	}
-		// C
-	case 3:
-	{
-		uint16_t addr = memory_read_word(mem, st->reg.PC);
-		DEBUG_OPCODES("JP C, %X\n", addr);
-		if ((st->reg.F & FLAG_CARRY) != 0) {
-			st->reg.PC = addr;
-			return 4;
-		} else {
-			st->reg.PC += 2;
-		}
-
-		return 3;
-	}
-        // LD (FF00+C), A
-    case 4:
-		DEBUG_OPCODES("LD (FF00+C), A\n");
-
-        memory_write_byte(mem, 0xFF00 + st->reg.C, st->reg.A);
-        return 2;
-
-        // LD (nn), A
-    case 5:
-	{
-		uint16_t addr = memory_read_word(mem, st->reg.PC);
-		st->reg.PC += 2;
-		memory_write_byte(mem, addr, st->reg.A);
-		DEBUG_OPCODES("LD (nn=%X), A\n", addr);
-
-		return 4;
-	}
-        // LD A, (FF00+C)
-    case 6:
-		DEBUG_OPCODES("LD A, (FF00+C)\n");
-
-        st->reg.A = memory_read_byte(mem, 0xFF00 + st->reg.C);
-        return 2;
+// JP HL
+static int8_t op_JP_HL(state* st, memory* mem, uint16_t imm) {
+	DEBUG_OPCODES("JP HL\n");
 
-        // LD A, (nn)
-    case 7:
-
-	{
-		uint16_t addr = memory_read_word(mem, st->reg.PC);
-		st->reg.PC += 2;
-		st->reg.A = memory_read_byte(mem, addr);
-		DEBUG_OPCODES("LD A, (nn=%x)\n", addr);
-
-		return 4;
-	}
-    }
-
-	return -1;
+	st->reg.PC = get_HL(st);
+	return 0;
 }
 
-// Assorted operations
-static int8_t handle_no_extra_x_3_z_3(uint8_t y, uint8_t z, uint8_t p, uint8_t q, state* st, memory* mem) {
-    switch(y) {
-        // JP nn
-    case 0:
-		st->reg.PC = memory_read_word(mem, st->reg.PC);
-		DEBUG_OPCODES("JP %X\n", st->reg.PC);
-
-		return 4;
-
-        // 0xCB prefix
-    case 1:
-        ERROR("Should never be here !\n");
-		return -1;
-
-        // OUT (n), A -- d not exists in GB
-    case 2:
-		ERROR("OUT (n), A is not available on GB\n");
-        return -1;
-
-        // IN A, (n) -- do not exists in GB
-    case 3:
-		ERROR("IN (n), A is not available on GB\n");
-        return -1;
-
-        // EX (SP), HL -- do not exists in GB
-    case 4:
-		ERROR("EX (SP), HL is not available on GB\n");
-        return -1;
-
-        // EX DE, HL -- do not exists in GB
-    case 5:
-		ERROR("EX DE, HL is not available on GB\n");
-        return -1;
-
-        // DI
-    case 6:
-		DEBUG_OPCODES("DI\n");
-		st->irq_master = 0;
-        return 1;
-
-        // EI
-    case 7:
-		DEBUG_OPCODES("EI\n");
-		st->irq_master = 1;
-        return 1;
-    }
+// LD SP, HL
+static int8_t op_LD_SP_HL(state* st, memory* mem, uint16_t imm) {
+	DEBUG_OPCODES("LD SP, HL\n");
 
-	return -1;
+	st->reg.SP = get_HL(st);
+	return 0;
 }
 
-// Condtionnal call -- CALL cc[y], nn
-static int8_t handle_no_extra_x_3_z_4(uint8_t y, uint8_t z, uint8_t p, uint8_t q, state* st, memory* mem) {
-
-	DEBUG_OPCODES("CALL %s, %X\n", resolve_cc(y), memory_read_word(mem, st->reg.PC));
-
-    switch(y) {
-		// NZ
-	case 0:
-		if ((st->reg.F & FLAG_ZERO) == 0) {
-            st->reg.SP -= 2;
-            memory_write_word(mem, st->reg.SP, st->reg.PC + 2);
-			st->reg.PC = memory_read_word(mem, st->reg.PC);
-
-			return 6;
-		} else {
-            st->reg.PC += sizeof(uint16_t);
-            return 3;
-        }
-
-		// Z
-	case 1:
-		if ((st->reg.F & FLAG_ZERO) != 0) {
-            st->reg.SP -= 2;
-            memory_write_word(mem, st->reg.SP, st->reg.PC + 2);
-			st->reg.PC = memory_read_word(mem, st->reg.PC);
-
-			return 6;
-		} else {
-            st->reg.PC += sizeof(uint16_t);
-            return 3;
-        }
-
-		// NC
-	case 2:
-		if ((st->reg.F & FLAG_CARRY) == 0) {
-            st->reg.SP -= 2;
-            memory_write_word(mem, st->reg.SP, st->reg.PC + 2);
-			st->reg.PC = memory_read_word(mem, st->reg.PC);
-
-			return 6;
-		} else {
-            st->reg.PC += sizeof(uint16_t);
-            return 3;
-        }
-
-		// C
-	case 3:
-		if ((st->reg.F & FLAG_CARRY) != 0) {
-            st->reg.SP -= 2;
-            memory_write_word(mem, st->reg.SP, st->reg.PC + 2);
-			st->reg.PC = memory_read_word(mem, st->reg.PC);
-
-			return 6;
-		} else {
-            st->reg.PC += sizeof(uint16_t);
-            return 3;
-        }
-
-        // Not implemented in GB
-    case 4:
-    case 5:
-    case 6:
-    case 7:
-		ERROR("Such an instruction for y = %d is not available on GB\n", y);
-        return -1;
-    }
+// LD (FF00+C), A
+static int8_t op_LDH_C_A(state* st, memory* mem, uint16_t imm) {
+	DEBUG_OPCODES("LD (FF00+C), A\n");
 
-	return -1;
+	memory_write_byte(mem, 0xFF00 + st->reg.C, st->reg.A);
+	return 0;
 }
 
-// PUSH & various op
-static int8_t handle_no_extra_x_3_z_5(uint8_t y, uint8_t z, uint8_t p, uint8_t q, state* st, memory* mem) {
-    // PUSH rp2[p]
-    if (q == 0) {
-        uint8_t *first = NULL;
-        uint8_t *second = NULL;
-
-		DEBUG_OPCODES("PUSH %s\n", resolve_register_pairs_v2_name(p));
-
+// LD (nn), A
+static int8_t op_LD_nn_A(state* st, memory* mem, uint16_t imm) {
+	uint16_t addr = imm;
+	memory_write_byte(mem, addr, st->reg.A);
+	DEBUG_OPCODES("LD (nn=%X), A\n", addr);
 
-        resolve_register_pairs_v2(st, p, &first, &second);
-        st->reg.SP -= 2;
-        memory_write_byte(mem, st->reg.SP, *second);
-        memory_write_byte(mem, st->reg.SP + 1, *first);
-
-        return 4;
-    } else {
-        switch(p) {
-            // CALL nn
-        case 0:
-            st->reg.SP -= 2;
-            memory_write_word(mem, st->reg.SP, st->reg.PC + 2);
-			st->reg.PC = memory_read_word(mem, st->reg.PC);
-
-			DEBUG_OPCODES("CALL %X\n", st->reg.PC);
-
-            return 6;
-
-            // other prefixes -- do not exists in GB
-        case 1:
-        case 2:
-        case 3:
-			ERROR("Such an instruction for p = %d is not available on GB\n", p);
-            return -1;
-        }
-    }
-
-	return -1;
+	return 0;
 }
 
-// Operate on accumulator and immediate operand
-static int8_t handle_no_extra_x_3_z_6(uint8_t y, uint8_t z, uint8_t p, uint8_t q, state* st, memory* mem) {
-
-    uint8_t val = memory_read_byte(mem, st->reg.PC);
-    st->reg.PC++;
-
-    switch(y) {
-		// ADD A,
-	case 0:
-	{
-		DEBUG_OPCODES("ADD A, %x\n", val);
-
-		uint16_t bound = st->reg.A + val;
-
-		st->reg.F = FLAG_NONE;
-
-		if ((bound & 0xF) < (st->reg.A & 0xF))
-			st->reg.F |= FLAG_HALF_CARRY;
-
-		if (bound > 0xFF)
-			st->reg.F |= FLAG_CARRY;
-
-		st->reg.A = (uint8_t)bound;
-
-		if (st->reg.A == 0)
-			st->reg.F |= FLAG_ZERO;
-
-		break;
-	}
-	// ADC A,
-	case 1:
-	{
-		DEBUG_OPCODES("ADC A, %x\n", val);
-
-		uint8_t flag = ((st->reg.F & FLAG_CARRY) ? 1 : 0);
-		int16_t bound = st->reg.A + val + flag;
-
-		st->reg.F = FLAG_NONE;
-
-		if ((st->reg.A & 0xF) + (val & 0xF) + flag > 0xF)
-			st->reg.F |= FLAG_HALF_CARRY;
-
-		if (bound > 0xFF)
-			st->reg.F |= FLAG_CARRY;
-
-		st->reg.A = (uint8_t)bound;
-
-		if (st->reg.A == 0)
-			st->reg.F |= FLAG_ZERO;
-
-		break;
-	}
-	// SUB
-	case 2:
-	{
-		DEBUG_OPCODES("SUB A, %x\n", val);
-
-		int16_t bound = st->reg.A - val;
-
-		st->reg.F = FLAG_SUBSTRACTION;
-		if (bound < 0)
-			st->reg.F |= FLAG_CARRY;
-
-		if ((st->reg.A & 0xF) < (bound & 0xF))
-			st->reg.F |= FLAG_HALF_CARRY;
-
-		st->reg.A = (uint8_t)bound;
-
-		if (st->reg.A == 0)
-			st->reg.F |= FLAG_ZERO;
-
-		break;
-	}
-	// SBC A,
-	case 3:
-	{
-		DEBUG_OPCODES("SBC A, %x\n", val);
-
-		uint8_t flag = (st->reg.F & FLAG_CARRY ? 1 : 0);
-		int16_t bound = st->reg.A - val - flag;
+// LD A, (FF00+C)
+static int8_t op_LDH_A_C(state* st, memory* mem, uint16_t imm) {
+	DEBUG_OPCODES("LD A, (FF00+C)\n");
 
-		st->reg.F = FLAG_SUBSTRACTION;
-
-		if (bound < 0)
-			st->reg.F |= FLAG_CARRY;
-
-		if ((st->reg.A & 0xF) - (val & 0xF) - flag < 0)
-			st->reg.F |= FLAG_HALF_CARRY;
-
-		st->reg.A = (uint8_t)bound;
-
-		if (st->reg.A == 0)
-			st->reg.F |= FLAG_ZERO;
-
-		break;
-	}
-	// AND
-	case 4:
-		DEBUG_OPCODES("AND A, %x\n", val);
-
-		st->reg.A &= val;
-		st->reg.F = FLAG_NONE;
-		if (st->reg.A == 0)
-			st->reg.F |= FLAG_ZERO;
-		st->reg.F |= FLAG_HALF_CARRY;
-
-		break;
-		// XOR
-	case 5:
-		DEBUG_OPCODES("XOR A, %x\n", val);
-
-		st->reg.A ^= val;
-		st->reg.F = FLAG_NONE;
-		if (st->reg.A == 0)
-			st->reg.F |= FLAG_ZERO;
-
-		break;
-		// OR
-	case 6:
-		DEBUG_OPCODES("OR A, %x\n", val);
-
-		st->reg.A |= val;
-		st->reg.F = FLAG_NONE;
-		if (st->reg.A == 0)
-			st->reg.F |= FLAG_ZERO;
-		break;
-		// CP
-	case 7:
-	{
-		DEBUG_OPCODES("CP A, %x\n", val);
-
-		int16_t bound = st->reg.A - val;
-		uint8_t i = 0;
-
-		st->reg.F = FLAG_SUBSTRACTION;
-		if (bound < 0)
-			st->reg.F |= FLAG_CARRY;
-
-		if ((bound & 0xF) > (st->reg.A & 0xF))
-			st->reg.F |= FLAG_HALF_CARRY;
-
-		i = (uint8_t)bound;
-
-		if (i == 0)
-			st->reg.F |= FLAG_ZERO;
-
-		break;
-	}
-	}
-
-    return 2;
+	st->reg.A = memory_read_byte(mem, 0xFF00 + st->reg.C);
+	return 0;
 }
 
-// Restart -- RST y*8
-static int8_t handle_no_extra_x_3_z_7(uint8_t y, uint8_t z, uint8_t p, uint8_t q, state* st, memory* mem) {
+// LD A, (nn)
+static int8_t op_LD_A_nn(state* st, memory* mem, uint16_t imm) {
+	uint16_t addr = imm;
+	st->reg.A = memory_read_byte(mem, addr);
+	DEBUG_OPCODES("LD A, (nn=%x)\n", addr);
 
-	DEBUG_OPCODES("RST %X\n", y*8);
+	return 0;
+}
 
-    st->reg.SP -= 2;
-    memory_write_word(mem, st->reg.SP, st->reg.PC);
-    st->reg.PC = y * 8;
+// JP nn
+static int8_t op_JP(state* st, memory* mem, uint16_t imm) {
+	st->reg.PC = imm;
+	DEBUG_OPCODES("JP %X\n", st->reg.PC);
 
-    return 4;
+	return 0;
 }
 
-static int8_t handle_no_extra_x_3(uint8_t y, uint8_t z, uint8_t p, uint8_t q, state* st, memory* mem) {
-	switch(z) {
-	case 0:
-		return handle_no_extra_x_3_z_0(y, z, p, q, st, mem);
-	case 1:
-		return handle_no_extra_x_3_z_1(y, z, p, q, st, mem);
-	case 2:
-		return handle_no_extra_x_3_z_2(y, z, p, q, st, mem);
-	case 3:
-		return handle_no_extra_x_3_z_3(y, z, p, q, st, mem);
-	case 4:
-		return handle_no_extra_x_3_z_4(y, z, p, q, st, mem);
-	case 5:
-		return handle_no_extra_x_3_z_5(y, z, p, q, st, mem);
-	case 6:
-		return handle_no_extra_x_3_z_6(y, z, p, q, st, mem);
-	case 7:
-		return handle_no_extra_x_3_z_7(y, z, p, q, st, mem);
-	}
+// DI
+static int8_t op_DI(state* st, memory* mem, uint16_t imm) {
+	DEBUG_OPCODES("DI\n");
+	st->irq_master = 0;
+	return 0;
+}
 
-	return -1;
+// EI
+static int8_t op_EI(state* st, memory* mem, uint16_t imm) {
+	DEBUG_OPCODES("EI\n");
+	st->irq_master = 1;
+	return 0;
 }
 
-// General function to decode an opcode.
-// Based on http://www.z80.info/decoding.htm
-static int8_t handle_OPCODE_general(z80_opcode opcode, state *st, memory* mem) {
+// CALL nn
+static int8_t op_CALL(state* st, memory* mem, uint16_t imm) {
+	st->reg.SP -= 2;
+	memory_write_word(mem, st->reg.SP, st->reg.PC);
+	st->reg.PC = imm;
 
-	// Check for prefix byte (only 0xCB on gameboy)
-	uint8_t has_extra_opcode = opcode == 0xCB;
-	uint8_t extra_opcode = 0;
-	if (has_extra_opcode) {
-		extra_opcode = memory_read_byte(mem, st->reg.PC);
-		st->reg.PC++;
-	}
+	DEBUG_OPCODES("CALL %X\n", st->reg.PC);
 
-	// Extract bit variables
-	uint8_t op = has_extra_opcode ? extra_opcode : opcode;
-	uint8_t x = 0;
-	uint8_t y = 0;
-	uint8_t z = 0;
-	uint8_t p = 0;
-	uint8_t q = 0;
-
-	x = (op & 0xC0) >> 6; // 0b11000000
-	y = (op & 0x38) >> 3; // 0b00111000
-	z = (op & 0x07) >> 0; // 0b00000111
-	p = (op & 0x30) >> 4; // 0b00110000
-	q = (op & 0x08) >> 3; // 0b00001000
-
-	if (!has_extra_opcode) {
-		switch(x) {
-		case 0:
-			return handle_no_extra_x_0(y, z, p, q, st, mem);
-		case 1:
-			return handle_no_extra_x_1(y, z, p, q, st, mem);
-		case 2:
-			return handle_no_extra_x_2(y, z, p, q, st, mem);
-		case 3:
-			return handle_no_extra_x_3(y, z, p, q, st, mem);
-		}
+	return 0;
+}
+
+// Restart -- RST y*8
+#define DEFINE_RST(n)													\
+	static int8_t op_RST_##n(state* st, memory* mem, uint16_t imm) {	\
+		DEBUG_OPCODES("RST %X\n", 0x##n);								\
+		st->reg.SP -= 2;												\
+		memory_write_word(mem, st->reg.SP, st->reg.PC);					\
+		st->reg.PC = 0x##n;												\
+		return 0;														\
+	}
+
+DEFINE_RST(00)
+DEFINE_RST(08)
+DEFINE_RST(10)
+DEFINE_RST(18)
+DEFINE_RST(20)
+DEFINE_RST(28)
+DEFINE_RST(30)
+DEFINE_RST(38)
+
+// Opcodes table, indexed by the opcode byte.
+// Decoding based on http://www.z80.info/decoding.htm
+static const opcode_handler opcodes_table[256] = {
+	// x = 0, z = 0: relative jumps and assorted ops
+	[0x00] = op_NOP,      [0x08] = op_LD_nn_SP, [0x10] = op_STOP,     [0x18] = op_JR,
+	[0x20] = op_JR_NZ,    [0x28] = op_JR_Z,     [0x30] = op_JR_NC,    [0x38] = op_JR_C,
+
+	// x = 0, z = 1: 16-bit load immediate/add
+	[0x01] = op_LD_BC_nn, [0x11] = op_LD_DE_nn, [0x21] = op_LD_HL_nn, [0x31] = op_LD_SP_nn,
+	[0x09] = op_ADD_HL_BC, [0x19] = op_ADD_HL_DE, [0x29] = op_ADD_HL_HL, [0x39] = op_ADD_HL_SP,
+
+	// x = 0, z = 2: indirect loading
+	[0x02] = op_LD_BC_A,  [0x12] = op_LD_DE_A,  [0x22] = op_LDI_HL_A, [0x32] = op_LDD_HL_A,
+	[0x0A] = op_LD_A_BC,  [0x1A] = op_LD_A_DE,  [0x2A] = op_LDI_A_HL, [0x3A] = op_LDD_A_HL,
+
+	// x = 0, z = 3: 16-bit INC/DEC
+	[0x03] = op_INC16_BC, [0x13] = op_INC16_DE, [0x23] = op_INC16_HL, [0x33] = op_INC16_SP,
+	[0x0B] = op_DEC16_BC, [0x1B] = op_DEC16_DE, [0x2B] = op_DEC16_HL, [0x3B] = op_DEC16_SP,
+
+	// x = 0, z = 4: 8-bit INC
+	[0x04] = op_INC_B,    [0x0C] = op_INC_C,    [0x14] = op_INC_D,    [0x1C] = op_INC_E,
+	[0x24] = op_INC_H,    [0x2C] = op_INC_L,    [0x34] = op_INC_HL,   [0x3C] = op_INC_A,
+
+	// x = 0, z = 5: 8-bit DEC
+	[0x05] = op_DEC_B,    [0x0D] = op_DEC_C,    [0x15] = op_DEC_D,    [0x1D] = op_DEC_E,
+	[0x25] = op_DEC_H,    [0x2D] = op_DEC_L,    [0x35] = op_DEC_HL,   [0x3D] = op_DEC_A,
+
+	// x = 0, z = 6: 8-bit load immediate
+	[0x06] = op_LD_B_n,   [0x0E] = op_LD_C_n,   [0x16] = op_LD_D_n,   [0x1E] = op_LD_E_n,
+	[0x26] = op_LD_H_n,   [0x2E] = op_LD_L_n,   [0x36] = op_LD_HL_n,  [0x3E] = op_LD_A_n,
+
+	// x = 0, z = 7: assorted operations on accumulator/flags
+	[0x07] = op_RLCA,     [0x0F] = op_RRCA,     [0x17] = op_RLA,      [0x1F] = op_RRA,
+	[0x27] = op_DAA,      [0x2F] = op_CPL,      [0x37] = op_SCF,      [0x3F] = op_CCF,
+
+	// x = 1: 8-bit loading, LD (HL), (HL) replaced by HALT
+	ROW_OPERANDS(0x40, op_LD_B),
+	ROW_OPERANDS(0x48, op_LD_C),
+	ROW_OPERANDS(0x50, op_LD_D),
+	ROW_OPERANDS(0x58, op_LD_E),
+	ROW_OPERANDS(0x60, op_LD_H),
+	ROW_OPERANDS(0x68, op_LD_L),
+	[0x70] = op_LD_HL_B,  [0x71] = op_LD_HL_C,  [0x72] = op_LD_HL_D,  [0x73] = op_LD_HL_E,
+	[0x74] = op_LD_HL_H,  [0x75] = op_LD_HL_L,  [0x76] = op_HALT,     [0x77] = op_LD_HL_A,
+	ROW_OPERANDS(0x78, op_LD_A),
+
+	// x = 2: operate on accumulator and register/memory location
+	ROW_OPERANDS(0x80, op_ADD),
+	ROW_OPERANDS(0x88, op_ADC),
+	ROW_OPERANDS(0x90, op_SUB),
+	ROW_OPERANDS(0x98, op_SBC),
+	ROW_OPERANDS(0xA0, op_AND),
+	ROW_OPERANDS(0xA8, op_XOR),
+	ROW_OPERANDS(0xB0, op_OR),
+	ROW_OPERANDS(0xB8, op_CP),
+
+	// x = 3, z = 0: conditionnal return and assorted ops
+	[0xC0] = op_RET_NZ,   [0xC8] = op_RET_Z,    [0xD0] = op_RET_NC,   [0xD8] = op_RET_C,
+	[0xE0] = op_LDH_n_A,  [0xE8] = op_ADD_SP_d, [0xF0] = op_LDH_A_n,  [0xF8] = op_LD_HL_SP_d,
+
+	// x = 3, z = 1: POP & various ops
+	[0xC1] = op_POP_BC,   [0xD1] = op_POP_DE,   [0xE1] = op_POP_HL,   [0xF1] = op_POP_AF,
+	[0xC9] = op_RET,      [0xD9] = op_RETI,     [0xE9] = op_JP_HL,    [0xF9] = op_LD_SP_HL,
+
+	// x = 3, z = 2: conditionnal jump and assorted ops
+	[0xC2] = op_JP_NZ,    [0xCA] = op_JP_Z,     [0xD2] = op_JP_NC,    [0xDA] = op_JP_C,
+	[0xE2] = op_LDH_C_A,  [0xEA] = op_LD_nn_A,  [0xF2] = op_LDH_A_C,  [0xFA] = op_LD_A_nn,
+
+	// x = 3, z = 3: assorted operations, OUT/IN/EX do not exist in GB
+	[0xC3] = op_JP,       [0xCB] = op_prefix_CB, [0xD3] = op_invalid, [0xDB] = op_invalid,
+	[0xE3] = op_invalid,  [0xEB] = op_invalid,  [0xF3] = op_DI,       [0xFB] = op_EI,
+
+	// x = 3, z = 4: conditionnal call, others do not exist in GB
+	[0xC4] = op_CALL_NZ,  [0xCC] = op_CALL_Z,   [0xD4] = op_CALL_NC,  [0xDC] = op_CALL_C,
+	[0xE4] = op_invalid,  [0xEC] = op_invalid,  [0xF4] = op_invalid,  [0xFC] = op_invalid,
+
+	// x = 3, z = 5: PUSH & CALL, other prefixes do not exist in GB
+	[0xC5] = op_PUSH_BC,  [0xD5] = op_PUSH_DE,  [0xE5] = op_PUSH_HL,  [0xF5] = op_PUSH_AF,
+	[0xCD] = op_CALL,     [0xDD] = op_invalid,  [0xED] = op_invalid,  [0xFD] = op_invalid,
+
+	// x = 3, z = 6: operate on accumulator and immediate operand
+	[0xC6] = op_ADD_n,    [0xCE] = op_ADC_n,    [0xD6] = op_SUB_n,    [0xDE] = op_SBC_n,
+	[0xE6] = op_AND_n,    [0xEE] = op_XOR_n,    [0xF6] = op_OR_n,     [0xFE] = op_CP_n,
+
+	// x = 3, z = 7: restart
+	[0xC7] = op_RST_00,   [0xCF] = op_RST_08,   [0xD7] = op_RST_10,   [0xDF] = op_RST_18,
+	[0xE7] = op_RST_20,   [0xEF] = op_RST_28,   [0xF7] = op_RST_30,   [0xFF] = op_RST_38,
+};
+
+// Immediate operand size, block ending and memory writing information,
+// indexed by opcode byte
+#define OPCODE_IMM8  0x1
+#define OPCODE_IMM16 0x2
+#define OPCODE_END   0x4
+#define OPCODE_STORE 0x8
+
+static const uint8_t opcodes_flags[256] = {
+	// 8-bit immediate
+	[0x06] = OPCODE_IMM8, [0x0E] = OPCODE_IMM8, [0x16] = OPCODE_IMM8, [0x1E] = OPCODE_IMM8,
+	[0x26] = OPCODE_IMM8, [0x2E] = OPCODE_IMM8, [0x36] = OPCODE_IMM8 | OPCODE_STORE, [0x3E] = OPCODE_IMM8,
+	[0xC6] = OPCODE_IMM8, [0xCE] = OPCODE_IMM8, [0xD6] = OPCODE_IMM8, [0xDE] = OPCODE_IMM8,
+	[0xE6] = OPCODE_IMM8, [0xEE] = OPCODE_IMM8, [0xF6] = OPCODE_IMM8, [0xFE] = OPCODE_IMM8,
+	[0xE0] = OPCODE_IMM8 | OPCODE_STORE, [0xE8] = OPCODE_IMM8, [0xF0] = OPCODE_IMM8, [0xF8] = OPCODE_IMM8,
+	[0xCB] = OPCODE_IMM8, // Prefixed opcode, fetched as an operand
+
+	// 16-bit immediate
+	[0x01] = OPCODE_IMM16, [0x11] = OPCODE_IMM16, [0x21] = OPCODE_IMM16, [0x31] = OPCODE_IMM16,
+	[0x08] = OPCODE_IMM16 | OPCODE_STORE, [0xEA] = OPCODE_IMM16 | OPCODE_STORE, [0xFA] = OPCODE_IMM16,
+
+	// Relative jumps
+	[0x18] = OPCODE_IMM8 | OPCODE_END, [0x20] = OPCODE_IMM8 | OPCODE_END,
+	[0x28] = OPCODE_IMM8 | OPCODE_END, [0x30] = OPCODE_IMM8 | OPCODE_END,
+	[0x38] = OPCODE_IMM8 | OPCODE_END,
+
+	// Jumps & calls, calls push the return address
+	[0xC3] = OPCODE_IMM16 | OPCODE_END, [0xCD] = OPCODE_IMM16 | OPCODE_END | OPCODE_STORE,
+	[0xC2] = OPCODE_IMM16 | OPCODE_END, [0xCA] = OPCODE_IMM16 | OPCODE_END,
+	[0xD2] = OPCODE_IMM16 | OPCODE_END, [0xDA] = OPCODE_IMM16 | OPCODE_END,
+	[0xC4] = OPCODE_IMM16 | OPCODE_END | OPCODE_STORE, [0xCC] = OPCODE_IMM16 | OPCODE_END | OPCODE_STORE,
+	[0xD4] = OPCODE_IMM16 | OPCODE_END | OPCODE_STORE, [0xDC] = OPCODE_IMM16 | OPCODE_END | OPCODE_STORE,
+	[0xE9] = OPCODE_END,
+
+	// Returns & restarts
+	[0xC9] = OPCODE_END, [0xD9] = OPCODE_END,
+	[0xC0] = OPCODE_END, [0xC8] = OPCODE_END, [0xD0] = OPCODE_END, [0xD8] = OPCODE_END,
+	[0xC7] = OPCODE_END | OPCODE_STORE, [0xCF] = OPCODE_END | OPCODE_STORE,
+	[0xD7] = OPCODE_END | OPCODE_STORE, [0xDF] = OPCODE_END | OPCODE_STORE,
+	[0xE7] = OPCODE_END | OPCODE_STORE, [0xEF] = OPCODE_END | OPCODE_STORE,
+	[0xF7] = OPCODE_END | OPCODE_STORE, [0xFF] = OPCODE_END | OPCODE_STORE,
+
+	// Memory writes
+	[0x02] = OPCODE_STORE, [0x12] = OPCODE_STORE, [0x22] = OPCODE_STORE, [0x32] = OPCODE_STORE,
+	[0x34] = OPCODE_STORE, [0x35] = OPCODE_STORE, [0x70] = OPCODE_STORE, [0x71] = OPCODE_STORE,
+	[0x72] = OPCODE_STORE, [0x73] = OPCODE_STORE, [0x74] = OPCODE_STORE, [0x75] = OPCODE_STORE,
+	[0x77] = OPCODE_STORE, [0xE2] = OPCODE_STORE,
+	[0xC5] = OPCODE_STORE, [0xD5] = OPCODE_STORE, [0xE5] = OPCODE_STORE, [0xF5] = OPCODE_STORE,
+
+	// Machine state changes
+	[0x10] = OPCODE_END, [0x76] = OPCODE_END, [0xF3] = OPCODE_END, [0xFB] = OPCODE_END,
+
+	// Invalid on GB
+	[0xD3] = OPCODE_END, [0xDB] = OPCODE_END, [0xDD] = OPCODE_END, [0xE3] = OPCODE_END,
+	[0xE4] = OPCODE_END, [0xEB] = OPCODE_END, [0xEC] = OPCODE_END, [0xED] = OPCODE_END,
+	[0xF4] = OPCODE_END, [0xFC] = OPCODE_END, [0xFD] = OPCODE_END,
+};
+
+// Base cycles of each opcode, conditional instructions not taken. Handlers
+// return the extra cycles (branch taken, prefixed opcode).
+static const uint8_t opcodes_cycles[256] = {
+	1, 3, 2, 2, 1, 1, 2, 1, 5, 2, 2, 2, 1, 1, 2, 1, // 0x00
+	1, 3, 2, 2, 1, 1, 2, 1, 3, 2, 2, 2, 1, 1, 2, 1, // 0x10
+	2, 3, 2, 2, 1, 1, 2, 1, 2, 2, 2, 2, 1, 1, 2, 1, // 0x20
+	2, 3, 2, 2, 3, 3, 3, 1, 2, 2, 2, 2, 1, 1, 2, 1, // 0x30
+	1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1, // 0x40
+	1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1, // 0x50
+	1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1, // 0x60
+	2, 2, 2, 2, 2, 2, 1, 2, 1, 1, 1, 1, 1, 1, 2, 1, // 0x70
+	1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1, // 0x80
+	1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1, // 0x90
+	1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1, // 0xA0
+	1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1, // 0xB0
+	2, 3, 3, 4, 3, 4, 2, 4, 2, 4, 3, 0, 3, 6, 2, 4, // 0xC0
+	2, 3, 3, 0, 3, 4, 2, 4, 2, 4, 3, 0, 3, 0, 2, 4, // 0xD0
+	3, 3, 2, 0, 0, 4, 2, 4, 4, 1, 4, 0, 0, 0, 2, 4, // 0xE0
+	3, 3, 2, 1, 0, 4, 2, 4, 3, 2, 4, 1, 0, 0, 2, 4, // 0xF0
+};
+
+// Decode the instruction at addr without executing it
+void opcodes_decode(memory* mem, uint16_t addr, opcode_info* info) {
+	z80_opcode opcode = memory_read_byte(mem, addr);
+	uint8_t flags = opcodes_flags[opcode];
+
+	info->length = 1;
+	info->operand = 0;
+	if (flags & OPCODE_IMM8) {
+		info->operand = memory_read_byte(mem, addr + 1);
+		info->length = 2;
+	}
+	if (flags & OPCODE_IMM16) {
+		info->operand = memory_read_word(mem, addr + 1);
+		info->length = 3;
+	}
+
+	// Prefixed opcodes are decoded directly, all but BIT write back (HL)
+	if (opcode == 0xCB) {
+		info->handler = cb_opcodes_table[info->operand];
+		info->cycles = cb_opcodes_cycles(info->operand);
+		info->store = (info->operand & 0x7) == 0x6 && (info->operand & 0xC0) != 0x40;
+		info->operand = 0;
 	} else {
-		switch(x) {
-		case 0:
-			return handle_roll(y, z, st, mem);
-		case 1:
-			return handle_bit(y, z, st, mem);
-		case 2:
-			return handle_res(y, z, st, mem);
-		case 3:
-			return handle_set(y, z, st, mem);
-		}
+		info->handler = opcodes_table[opcode];
+		info->cycles = opcodes_cycles[opcode];
+		info->store = (flags & OPCODE_STORE) != 0;
 	}
 
-	return -1;
+	info->end_block = (flags & OPCODE_END) != 0;
 }
 
 static void dump_states(state *st) {
@@ -1719,14 +1191,32 @@ static void dump_states(state *st) {
 
 }
 
-// Execute an opcode (separate function to not export opcodes tables)
-int8_t opcodes_execute(z80_opcode opcode, state* st, memory* mem) {
+// Run an already decoded opcode
+int8_t opcodes_run(opcode_handler handler, state* st, memory* mem, uint16_t imm) {
 	DEBUG_OPCODES("%X: ", st->reg.PC);
-	int8_t ret = handle_OPCODE_general(opcode, st, mem);
-
-	// F register, only up nibble
-	st->reg.F &= 0xF0;
+	int8_t ret = handler(st, mem, imm);
 	dump_states(st);
 
 	return ret;
 }
+
+// Execute an opcode, PC pointing after it (separate function to not export
+// opcodes tables)
+int8_t opcodes_execute(z80_opcode opcode, state* st, memory* mem) {
+	uint8_t flags = opcodes_flags[opcode];
+	uint16_t imm = 0;
+
+	if (flags & OPCODE_IMM8) {
+		imm = memory_read_byte(mem, st->reg.PC);
+		st->reg.PC++;
+	} else if (flags & OPCODE_IMM16) {
+		imm = memory_read_word(mem, st->reg.PC);
+		st->reg.PC += 2;
+	}
+
+	int8_t extra = opcodes_run(opcodes_table[opcode], st, mem, imm);
+	if (extra < 0)
+		return extra;
+
+	return opcodes_cycles[opcode] + extra;
+}
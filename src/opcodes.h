@@ -8,6 +8,23 @@
 
 typedef uint8_t z80_opcode;
 
+// An opcode function. Take the current machine state, the memory and the
+// immediate operand and return the cycles taken on top of the opcode base cost
+// (branch taken). PC points after the whole instruction when called.
+typedef int8_t (*opcode_handler)(state* st, memory* mem, uint16_t imm);
+
+// Decoded instruction
+typedef struct opcode_info {
+	opcode_handler handler;
+	uint16_t operand;  // Pre-fetched immediate operand
+	uint8_t length;    // Whole instruction bytes, immediate operands included
+	uint8_t cycles;    // Base cycles, 0xCB prefix included
+	uint8_t end_block; // Control flow or machine state change, ends a basic block
+	uint8_t store;     // Writes memory, the stack included
+} opcode_info;
+
 void opcodes_init();
 int8_t opcodes_execute(z80_opcode opcode, state* st, memory* mem);
+void opcodes_decode(memory* mem, uint16_t addr, opcode_info* info);
+int8_t opcodes_run(opcode_handler handler, state* st, memory* mem, uint16_t imm);
 #endif     // __OPCODES_H__
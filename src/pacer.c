@@ -0,0 +1,61 @@
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include "log.h"
+#include "memory.h"
+#include "gpu.h"
+#include "pacer.h"
+#include "scheduler.h"
+
+static uint64_t pacer_clock(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Speed is a multiplier of the real hardware speed, 0 runs unthrottled
+pacer* pacer_init(memory *mem, double speed) {
+	pacer *pc = calloc(1, sizeof(pacer));
+	if (pc == NULL)
+		ERROR("Unable to allocate memory for pacer.\n");
+
+	if (speed < 0)
+		ERROR("Invalid emulation speed %f\n", speed);
+
+	pc->sch = mem->sch;
+	pc->ev = NULL;
+	if (speed == 0)
+		return pc;
+
+	pc->frame_ns = GPU_FRAME_TIMING * 1000000000.0 / PACER_CPU_FREQUENCY / speed;
+	pc->deadline = pacer_clock() + pc->frame_ns;
+	pc->ev = scheduler_add_event(pc->sch, pacer_process, pc);
+	scheduler_schedule(pc->sch, pc->ev, pc->sch->now + GPU_FRAME_TIMING);
+	return pc;
+}
+
+void pacer_end(pacer *pc) {
+	free(pc);
+}
+
+// Scheduler event at the end of each emulated frame, sleep until its host
+// deadline
+void pacer_process(void* dev, uint64_t now) {
+	pacer *pc = dev;
+	uint64_t host = pacer_clock();
+
+	scheduler_schedule(pc->sch, pc->ev, now + GPU_FRAME_TIMING);
+
+	pc->late = host > pc->deadline;
+	if (host < pc->deadline) {
+		struct timespec ts;
+		ts.tv_sec = pc->deadline / 1000000000;
+		ts.tv_nsec = pc->deadline % 1000000000;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+	} else if (host - pc->deadline > PACER_MAX_LATE * pc->frame_ns) {
+		// Too late (host busy, debugger...), do not rush the next frames
+		pc->deadline = host;
+	}
+
+	pc->deadline += pc->frame_ns;
+}
@@ -0,0 +1,26 @@
+#ifndef __PACER_H__
+#define __PACER_H__
+
+#include <stdint.h>
+
+#define PACER_CPU_FREQUENCY 1048576 // Cycles per second
+#define PACER_MAX_LATE 4            // Frames behind before giving up catching up
+
+typedef struct memory memory;
+typedef struct scheduler scheduler;
+typedef struct scheduler_event scheduler_event;
+
+// Keep the emulation in step with the host monotonic clock. Each frame has a
+// fixed deadline, only the time left before it is slept.
+typedef struct pacer {
+	scheduler *sch;
+	scheduler_event *ev; // End of the current frame
+	uint64_t frame_ns;   // Host duration of a frame
+	uint64_t deadline;   // Host time the current frame ends at
+	uint8_t late;        // Last frame ended after its deadline
+} pacer;
+
+pacer* pacer_init(memory *mem, double speed);
+void pacer_end(pacer *pc);
+void pacer_process(void* dev, uint64_t now);
+#endif     // __PACER_H__
@@ -0,0 +1,136 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "log.h"
+#include "presenter.h"
+#include "gpu_simd.h"
+
+// Screen shades of the palette colors
+const uint8_t presenter_shades[4] = { 0xFF, 0xC0, 0x60, 0x00 };
+
+// Write a line of values scaled factor times to the screen, as shades
+static uint8_t* presenter_scale_line(presenter *pr, uint8_t *values, uint16_t width, uint8_t factor,
+                                     uint8_t *pixels, uint16_t pitch) {
+	uint8_t i = 0;
+
+	if (factor == 1) {
+		gpu_simd_map(values, presenter_shades, pixels, width);
+	} else {
+		gpu_simd_map(values, presenter_shades, pr->shaded, width);
+		gpu_simd_widen(pr->shaded, pixels, width, factor);
+	}
+
+	for (i = 1; i < factor; i++)
+		memcpy(pixels + i * pitch, pixels, width * factor);
+	return pixels + factor * pitch;
+}
+
+// Scale2x needs the frame with its borders repeated
+static void presenter_pad(presenter *pr, uint8_t (*frame)[SCREEN_WIDTH]) {
+	uint8_t y = 0;
+	for (y = 0; y < SCREEN_HEIGHT; y++) {
+		memcpy(pr->padded[y] + 1, frame[y], SCREEN_WIDTH);
+		pr->padded[y][0] = frame[y][0];
+		pr->padded[y][SCREEN_WIDTH + 1] = frame[y][SCREEN_WIDTH - 1];
+	}
+}
+
+// Convert the frame to scaled screen shades a line at a time, the screen is
+// locked once per frame
+static void presenter_show(presenter *pr, uint8_t (*frame)[SCREEN_WIDTH]) {
+	uint16_t pitch = 0;
+	uint8_t* pixels = pr->backend->lock(pr->backend_data, &pitch);
+
+	uint8_t y = 0;
+	if (pr->filter == PRESENTER_SCALE2X) {
+		presenter_pad(pr, frame);
+		for (y = 0; y < SCREEN_HEIGHT; y++) {
+			uint8_t *above = pr->padded[y > 0 ? y - 1 : y] + 1;
+			uint8_t *below = pr->padded[y < SCREEN_HEIGHT - 1 ? y + 1 : y] + 1;
+			gpu_simd_scale2x(above, pr->padded[y] + 1, below, pr->filtered[0], pr->filtered[1], SCREEN_WIDTH);
+			pixels = presenter_scale_line(pr, pr->filtered[0], 2 * SCREEN_WIDTH, pr->scale / 2, pixels, pitch);
+			pixels = presenter_scale_line(pr, pr->filtered[1], 2 * SCREEN_WIDTH, pr->scale / 2, pixels, pitch);
+		}
+	} else {
+		for (y = 0; y < SCREEN_HEIGHT; y++)
+			pixels = presenter_scale_line(pr, frame[y], SCREEN_WIDTH, pr->scale, pixels, pitch);
+	}
+
+	pr->backend->unlock(pr->backend_data);
+	pr->backend->flip(pr->backend_data);
+}
+
+static void* presenter_run(void* arg) {
+	presenter *pr = arg;
+
+	// The backend is only used from this thread
+	pr->backend_data = pr->backend->init(SCREEN_WIDTH * pr->scale, SCREEN_HEIGHT * pr->scale);
+	sem_post(&(pr->ready));
+
+	while (atomic_load(&(pr->running))) {
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += PRESENTER_IDLE_MS * 1000000;
+		if (ts.tv_nsec >= 1000000000) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+		if (sem_timedwait(&(pr->wake), &ts) == 0)
+			while (sem_trywait(&(pr->wake)) == 0);
+
+		// Take the last completed frame, give back the one shown
+		if (atomic_load(&(pr->exchanged)) & PRESENTER_FRESH) {
+			pr->front = atomic_exchange(&(pr->exchanged), pr->front) & PRESENTER_INDEX;
+			presenter_show(pr, pr->frames[pr->front]);
+		}
+
+		pr->backend->pump(pr->backend_data);
+	}
+
+	pr->backend->end(pr->backend_data);
+	return NULL;
+}
+
+presenter* presenter_init(const gpu_backend *backend, uint8_t scale, presenter_filter filter) {
+	presenter *pr = calloc(1, sizeof(presenter));
+	if (pr == NULL)
+		ERROR("Unable to allocate memory for presenter.\n");
+
+	// Scale2x doubles the size before the nearest neighbour scaling
+	if (scale < 1 || scale > PRESENTER_MAX_SCALE || (filter == PRESENTER_SCALE2X && scale % 2 != 0))
+		ERROR("Unsupported presentation scale %d.\n", scale);
+
+	pr->backend = backend;
+	pr->scale = scale;
+	pr->filter = filter;
+	pr->back = 0;
+	pr->front = 1;
+	atomic_init(&(pr->exchanged), 2);
+	atomic_init(&(pr->running), 1);
+
+	if (sem_init(&(pr->wake), 0, 0) != 0 || sem_init(&(pr->ready), 0, 0) != 0)
+		ERROR("Unable to create presenter semaphore.\n");
+
+	if (pthread_create(&(pr->thread), NULL, presenter_run, pr) != 0)
+		ERROR("Unable to create presenter thread.\n");
+
+	// Wait for the backend to be ready
+	while (sem_wait(&(pr->ready)) != 0);
+	return pr;
+}
+
+void presenter_end(presenter *pr) {
+	atomic_store(&(pr->running), 0);
+	sem_post(&(pr->wake));
+	pthread_join(pr->thread, NULL);
+	sem_destroy(&(pr->wake));
+	sem_destroy(&(pr->ready));
+	free(pr);
+}
+
+// Hand over a completed frame, never blocks
+void presenter_publish(presenter *pr, uint8_t (*frame)[SCREEN_WIDTH]) {
+	memcpy(pr->frames[pr->back], frame, sizeof(pr->frames[pr->back]));
+	pr->back = atomic_exchange(&(pr->exchanged), pr->back | PRESENTER_FRESH) & PRESENTER_INDEX;
+	sem_post(&(pr->wake));
+}
@@ -0,0 +1,59 @@
+#ifndef __PRESENTER_H__
+#define __PRESENTER_H__
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include "gpu.h"
+#include "gpu_simd.h"
+
+#define PRESENTER_BUFFERS 3
+#define PRESENTER_FRESH   0x80 // Exchanged frame not shown yet
+#define PRESENTER_INDEX   0x7F
+#define PRESENTER_IDLE_MS 10   // Backend events are handled at least this often
+#define PRESENTER_MAX_SCALE GPU_SIMD_MAX_FACTOR
+
+// Upscaling of the frames, on the presenter thread
+typedef enum {
+	PRESENTER_NEAREST, // Each pixel is repeated scale times
+	PRESENTER_SCALE2X  // Scale2x edge smoothing, then nearest for scale / 2
+} presenter_filter;
+
+// Frames are shown by a separate thread, which owns the video backend. The
+// emulation never waits for the display: completed frames are handed over
+// through a single exchanged buffer, a frame not shown in time is replaced by
+// the next one.
+typedef struct presenter {
+	const gpu_backend *backend;
+	void *backend_data;
+
+	// Screen is scale times the frame size
+	uint8_t scale;
+	presenter_filter filter;
+
+	// Frame line with one pixel repeated on each side, for Scale2x
+	uint8_t padded[SCREEN_HEIGHT][SCREEN_WIDTH + 2];
+	// Lines of the frame being scaled
+	uint8_t filtered[2][2 * SCREEN_WIDTH];
+	uint8_t shaded[2 * SCREEN_WIDTH];
+
+	// Triple buffering: the emulation fills back, the presenter shows front
+	// and the last completed frame is in the exchanged one
+	uint8_t frames[PRESENTER_BUFFERS][SCREEN_HEIGHT][SCREEN_WIDTH];
+	uint8_t back;
+	uint8_t front;
+	atomic_uint_fast8_t exchanged;
+
+	pthread_t thread;
+	sem_t wake;  // Posted for each frame and to stop
+	sem_t ready; // Posted once the backend is initiated
+	atomic_int running;
+} presenter;
+
+extern const uint8_t presenter_shades[4];
+
+presenter* presenter_init(const gpu_backend *backend, uint8_t scale, presenter_filter filter);
+void presenter_end(presenter *pr);
+void presenter_publish(presenter *pr, uint8_t (*frame)[SCREEN_WIDTH]);
+#endif     // __PRESENTER_H__
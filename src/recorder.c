@@ -0,0 +1,231 @@
+#include <stdlib.h>
+#include <string.h>
+#include "log.h"
+#include "recorder.h"
+#include "presenter.h"
+#include "pacer.h"
+#include "gpu_simd.h"
+
+// PNG chunks checksum, CRC-32 of the ISO 3309
+static uint32_t recorder_crc32(uint32_t crc, const uint8_t *data, uint32_t size) {
+	static uint32_t table[256];
+	static uint8_t table_ready = 0;
+	uint32_t i = 0, j = 0;
+
+	if (!table_ready) {
+		for (i = 0; i < 256; i++) {
+			uint32_t c = i;
+			for (j = 0; j < 8; j++)
+				c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+			table[i] = c;
+		}
+		table_ready = 1;
+	}
+
+	crc = ~crc;
+	for (i = 0; i < size; i++)
+		crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
+
+static void recorder_put_be32(uint8_t *out, uint32_t value) {
+	out[0] = value >> 24;
+	out[1] = value >> 16;
+	out[2] = value >> 8;
+	out[3] = value;
+}
+
+static void recorder_png_chunk(FILE *file, const char *type, const uint8_t *data, uint32_t size) {
+	uint8_t header[8];
+	uint8_t crc[4];
+
+	recorder_put_be32(header, size);
+	memcpy(header + 4, type, 4);
+	recorder_put_be32(crc, recorder_crc32(recorder_crc32(0, header + 4, 4), data, size));
+
+	fwrite(header, 1, sizeof(header), file);
+	fwrite(data, 1, size, file);
+	fwrite(crc, 1, sizeof(crc), file);
+}
+
+// Grayscale PNG of the frame shades. The image fits in a single stored
+// deflate block, no compression library is needed.
+static void recorder_write_png(const char *path, uint8_t (*shades)[SCREEN_WIDTH]) {
+	static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	const uint16_t raw_size = SCREEN_HEIGHT * (SCREEN_WIDTH + 1);
+	const uint16_t raw_size_neg = ~raw_size;
+	uint8_t ihdr[13];
+	uint8_t idat[2 + 5 + SCREEN_HEIGHT * (SCREEN_WIDTH + 1) + 4];
+	uint32_t a = 1, b = 0;
+	uint16_t i = 0, y = 0;
+
+	FILE *file = fopen(path, "wb");
+	if (file == NULL) {
+		WARN("Unable to open screenshot %s.\n", path);
+		return;
+	}
+
+	// Size, 8 bits grayscale, no interlacing
+	recorder_put_be32(ihdr, SCREEN_WIDTH);
+	recorder_put_be32(ihdr + 4, SCREEN_HEIGHT);
+	ihdr[8] = 8;
+	ihdr[9] = 0;
+	ihdr[10] = ihdr[11] = ihdr[12] = 0;
+
+	// zlib header, final stored block, lines without filter, adler32
+	uint8_t *p = idat;
+	*p++ = 0x78;
+	*p++ = 0x01;
+	*p++ = 0x01;
+	*p++ = raw_size & 0xFF;
+	*p++ = raw_size >> 8;
+	*p++ = raw_size_neg & 0xFF;
+	*p++ = raw_size_neg >> 8;
+	for (y = 0; y < SCREEN_HEIGHT; y++) {
+		*p++ = 0;
+		memcpy(p, shades[y], SCREEN_WIDTH);
+		p += SCREEN_WIDTH;
+	}
+	for (i = 0; i < raw_size; i++) {
+		a = (a + idat[7 + i]) % 65521;
+		b = (b + a) % 65521;
+	}
+	recorder_put_be32(p, (b << 16) | a);
+
+	fwrite(signature, 1, sizeof(signature), file);
+	recorder_png_chunk(file, "IHDR", ihdr, sizeof(ihdr));
+	recorder_png_chunk(file, "IDAT", idat, sizeof(idat));
+	recorder_png_chunk(file, "IEND", NULL, 0);
+	fclose(file);
+}
+
+static void recorder_write(recorder *rc, recorder_slot *slot) {
+	uint8_t shades[SCREEN_HEIGHT][SCREEN_WIDTH];
+	uint8_t y = 0;
+
+	for (y = 0; y < SCREEN_HEIGHT; y++)
+		gpu_simd_map(slot->pixels[y], presenter_shades, shades[y], SCREEN_WIDTH);
+
+	// Y4M frames are the luma plane alone
+	if (slot->targets & RECORDER_VIDEO) {
+		fputs("FRAME\n", rc->video);
+		fwrite(shades, 1, sizeof(shades), rc->video);
+	}
+
+	if (slot->targets & RECORDER_SHOT) {
+		char path[4096];
+		snprintf(path, sizeof(path), "%s-%u.png", rc->shot_prefix, slot->number);
+		recorder_write_png(path, shades);
+	}
+}
+
+// Write all the pending frames at each wake up, until stopped and drained
+static void* recorder_run(void* arg) {
+	recorder *rc = arg;
+
+	while (1) {
+		while (sem_wait(&(rc->wake)) != 0);
+
+		unsigned tail = atomic_load_explicit(&(rc->tail), memory_order_relaxed);
+		unsigned head = atomic_load_explicit(&(rc->head), memory_order_acquire);
+		for (; tail != head; tail++) {
+			recorder_write(rc, &(rc->slots[tail % RECORDER_SLOTS]));
+			atomic_store_explicit(&(rc->tail), tail + 1, memory_order_release);
+		}
+
+		if (!atomic_load(&(rc->running)) && tail == atomic_load(&(rc->head)))
+			break;
+	}
+
+	return NULL;
+}
+
+static int recorder_compare_shots(const void *a, const void *b) {
+	uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+	return (x > y) - (x < y);
+}
+
+// Record frames as a Y4M video when video is not NULL, and save the frames
+// numbered in shots as PNG screenshots
+recorder* recorder_init(const char *video, const char *shot_prefix, const uint32_t *shots, uint8_t shot_count) {
+	recorder *rc = calloc(1, sizeof(recorder));
+	if (rc == NULL)
+		ERROR("Unable to allocate memory for recorder.\n");
+
+	if (shot_count > RECORDER_MAX_SHOTS)
+		ERROR("Too many screenshots requested (%d).\n", shot_count);
+
+	if (video != NULL) {
+		rc->video = fopen(video, "wb");
+		if (rc->video == NULL)
+			ERROR("Unable to open video file %s.\n", video);
+
+		// Frames are gathered in large writes
+		setvbuf(rc->video, NULL, _IOFBF, RECORDER_BUFFER_SIZE);
+		fprintf(rc->video, "YUV4MPEG2 W%d H%d F%d:%d Ip A1:1 Cmono\n",
+		        SCREEN_WIDTH, SCREEN_HEIGHT, PACER_CPU_FREQUENCY, GPU_FRAME_TIMING);
+	}
+
+	rc->shot_prefix = strdup(shot_prefix != NULL ? shot_prefix : "screenshot");
+	if (rc->shot_prefix == NULL)
+		ERROR("Unable to allocate memory for recorder.\n");
+	memcpy(rc->shots, shots, shot_count * sizeof(uint32_t));
+	qsort(rc->shots, shot_count, sizeof(uint32_t), recorder_compare_shots);
+	rc->shot_count = shot_count;
+
+	atomic_init(&(rc->head), 0);
+	atomic_init(&(rc->tail), 0);
+	atomic_init(&(rc->running), 1);
+
+	if (sem_init(&(rc->wake), 0, 0) != 0)
+		ERROR("Unable to create recorder semaphore.\n");
+
+	if (pthread_create(&(rc->thread), NULL, recorder_run, rc) != 0)
+		ERROR("Unable to create recorder thread.\n");
+
+	return rc;
+}
+
+// Write the frames left before closing
+void recorder_end(recorder *rc) {
+	atomic_store(&(rc->running), 0);
+	sem_post(&(rc->wake));
+	pthread_join(rc->thread, NULL);
+	sem_destroy(&(rc->wake));
+
+	if (rc->dropped > 0)
+		WARN("Recorder dropped %u frames.\n", rc->dropped);
+
+	if (rc->video != NULL)
+		fclose(rc->video);
+	free(rc->shot_prefix);
+	free(rc);
+}
+
+// Queue a completed frame, never blocks
+void recorder_push(recorder *rc, uint8_t (*frame)[SCREEN_WIDTH]) {
+	uint32_t number = rc->frame++;
+	uint8_t targets = rc->video != NULL ? RECORDER_VIDEO : 0;
+
+	// Skip the screenshots listed twice
+	while (rc->next_shot < rc->shot_count && rc->shots[rc->next_shot] < number)
+		rc->next_shot++;
+	if (rc->next_shot < rc->shot_count && rc->shots[rc->next_shot] == number)
+		targets |= RECORDER_SHOT;
+
+	if (targets == 0)
+		return;
+
+	unsigned head = atomic_load_explicit(&(rc->head), memory_order_relaxed);
+	if (head - atomic_load_explicit(&(rc->tail), memory_order_acquire) == RECORDER_SLOTS) {
+		rc->dropped++;
+		return;
+	}
+
+	recorder_slot *slot = &(rc->slots[head % RECORDER_SLOTS]);
+	memcpy(slot->pixels, frame, sizeof(slot->pixels));
+	slot->number = number;
+	slot->targets = targets;
+	atomic_store_explicit(&(rc->head), head + 1, memory_order_release);
+	sem_post(&(rc->wake));
+}
@@ -0,0 +1,50 @@
+#ifndef __RECORDER_H__
+#define __RECORDER_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include "gpu.h"
+
+#define RECORDER_SLOTS       16      // Frames waiting to be written at most
+#define RECORDER_BUFFER_SIZE (1 << 20)
+#define RECORDER_MAX_SHOTS   64
+#define RECORDER_VIDEO       0x1     // Frame goes to the video stream
+#define RECORDER_SHOT        0x2     // Frame is saved as a PNG screenshot
+
+// A recorded frame and what to do with it
+typedef struct recorder_slot {
+	uint8_t pixels[SCREEN_HEIGHT][SCREEN_WIDTH];
+	uint32_t number;
+	uint8_t targets;
+} recorder_slot;
+
+// Frames are written by a separate thread, the emulation only copies them in
+// a ring of slots. A frame arriving on a full ring is dropped rather than
+// waiting for the disk.
+typedef struct recorder {
+	FILE *video;                  // Y4M stream, NULL when not recorded
+	char *shot_prefix;            // Screenshots are <prefix>-<frame>.png
+	uint32_t shots[RECORDER_MAX_SHOTS]; // Frames to save, ascending
+	uint8_t shot_count;
+	uint8_t next_shot;
+
+	uint32_t frame;               // Frames seen since power on
+	uint32_t dropped;
+
+	// Single producer, single consumer ring
+	recorder_slot slots[RECORDER_SLOTS];
+	atomic_uint head;             // Next slot written by the emulation
+	atomic_uint tail;             // Next slot read by the writer
+
+	pthread_t thread;
+	sem_t wake;                   // Posted for each frame and to stop
+	atomic_int running;
+} recorder;
+
+recorder* recorder_init(const char *video, const char *shot_prefix, const uint32_t *shots, uint8_t shot_count);
+void recorder_end(recorder *rc);
+void recorder_push(recorder *rc, uint8_t (*frame)[SCREEN_WIDTH]);
+#endif     // __RECORDER_H__
@@ -0,0 +1,131 @@
+#include <stdlib.h>
+
+#include "scheduler.h"
+#include "memory.h"
+#include "log.h"
+
+scheduler* scheduler_init(memory* mem) {
+	scheduler* sch = calloc(1, sizeof(scheduler));
+	if (sch == NULL)
+		ERROR("Unable to allocate memory for scheduler.\n");
+
+	sch->now = 0;
+	sch->next = SCHEDULER_NEVER;
+
+	memory_set_scheduler(mem, sch);
+	return sch;
+}
+
+void scheduler_end(scheduler* sch) {
+	free(sch);
+}
+
+scheduler_event* scheduler_add_event(scheduler* sch, scheduler_callback callback, void* dev) {
+	if (sch->event_count == SCHEDULER_MAX_EVENTS)
+		ERROR("Too many scheduler events.\n");
+
+	scheduler_event* ev = &(sch->events[sch->event_count++]);
+	ev->deadline = SCHEDULER_NEVER;
+	ev->callback = callback;
+	ev->dev = dev;
+	ev->index = -1;
+	return ev;
+}
+
+// Events due at the same time run in registration order
+static inline int scheduler_before(scheduler_event* a, scheduler_event* b) {
+	if (a->deadline != b->deadline)
+		return a->deadline < b->deadline;
+	return a < b;
+}
+
+static void scheduler_place(scheduler* sch, scheduler_event* ev, uint8_t index) {
+	sch->heap[index] = ev;
+	ev->index = index;
+}
+
+static void scheduler_sift_up(scheduler* sch, uint8_t index) {
+	scheduler_event* ev = sch->heap[index];
+
+	while (index > 0) {
+		uint8_t parent = (index - 1) / 2;
+		if (!scheduler_before(ev, sch->heap[parent]))
+			break;
+
+		scheduler_place(sch, sch->heap[parent], index);
+		index = parent;
+	}
+
+	scheduler_place(sch, ev, index);
+}
+
+static void scheduler_sift_down(scheduler* sch, uint8_t index) {
+	scheduler_event* ev = sch->heap[index];
+
+	while (2 * index + 1 < sch->heap_size) {
+		uint8_t child = 2 * index + 1;
+		if (child + 1 < sch->heap_size && scheduler_before(sch->heap[child + 1], sch->heap[child]))
+			child++;
+
+		if (!scheduler_before(sch->heap[child], ev))
+			break;
+
+		scheduler_place(sch, sch->heap[child], index);
+		index = child;
+	}
+
+	scheduler_place(sch, ev, index);
+}
+
+static void scheduler_update_next(scheduler* sch) {
+	sch->next = sch->heap_size ? sch->heap[0]->deadline : SCHEDULER_NEVER;
+}
+
+// Schedule (or move) an event
+void scheduler_schedule(scheduler* sch, scheduler_event* ev, uint64_t deadline) {
+	uint64_t previous = ev->deadline;
+	ev->deadline = deadline;
+
+	if (ev->index < 0) {
+		ev->index = sch->heap_size++;
+		sch->heap[ev->index] = ev;
+		scheduler_sift_up(sch, ev->index);
+	} else if (deadline < previous) {
+		scheduler_sift_up(sch, ev->index);
+	} else {
+		scheduler_sift_down(sch, ev->index);
+	}
+
+	scheduler_update_next(sch);
+}
+
+void scheduler_cancel(scheduler* sch, scheduler_event* ev) {
+	if (ev->index < 0)
+		return;
+
+	uint8_t index = ev->index;
+	scheduler_event* last = sch->heap[--sch->heap_size];
+	ev->index = -1;
+	ev->deadline = SCHEDULER_NEVER;
+
+	if (last != ev) {
+		scheduler_place(sch, last, index);
+		scheduler_sift_up(sch, index);
+		scheduler_sift_down(sch, last->index);
+	}
+
+	scheduler_update_next(sch);
+}
+
+// Run all events due at the current time. Callbacks usually schedule their
+// next deadline, an event left unscheduled does not run again. They are given
+// their deadline, not the current time, so periodic events scheduled from it
+// do not accumulate the instructions overshoot.
+void scheduler_run(scheduler* sch) {
+	while (sch->heap_size && sch->heap[0]->deadline <= sch->now) {
+		scheduler_event* ev = sch->heap[0];
+		uint64_t deadline = ev->deadline;
+		scheduler_cancel(sch, ev);
+		ev->callback(ev->dev, deadline);
+	}
+}
@@ -0,0 +1,48 @@
+#ifndef __SCHEDULER_H__
+#define __SCHEDULER_H__
+
+#include <stdint.h>
+
+// Cycle timestamped events. Components schedule their next state change and
+// the CPU runs uninterrupted up to the nearest deadline.
+
+#define SCHEDULER_MAX_EVENTS 8
+#define SCHEDULER_NEVER      UINT64_MAX
+
+typedef struct memory memory;
+
+// Called once the clock reached the event deadline, with that deadline
+typedef void (*scheduler_callback)(void* dev, uint64_t now);
+
+typedef struct scheduler_event {
+	uint64_t deadline;
+	scheduler_callback callback;
+	void* dev;
+	int8_t index; // Position in the heap, -1 when not scheduled
+} scheduler_event;
+
+typedef struct scheduler {
+	uint64_t now;  // Cycles since power on
+	uint64_t next; // Nearest deadline
+
+	// Events, min-heap ordered by deadline
+	scheduler_event events[SCHEDULER_MAX_EVENTS];
+	scheduler_event* heap[SCHEDULER_MAX_EVENTS];
+	uint8_t event_count;
+	uint8_t heap_size;
+} scheduler;
+
+scheduler* scheduler_init(memory* mem);
+void scheduler_end(scheduler* sch);
+scheduler_event* scheduler_add_event(scheduler* sch, scheduler_callback callback, void* dev);
+void scheduler_schedule(scheduler* sch, scheduler_event* ev, uint64_t deadline);
+void scheduler_cancel(scheduler* sch, scheduler_event* ev);
+void scheduler_run(scheduler* sch);
+
+// Run events due at the current time, components state is then up to date
+static inline void scheduler_sync(scheduler* sch) {
+	if (sch->now >= sch->next)
+		scheduler_run(sch);
+}
+
+#endif     // __SCHEDULER_H__
@@ -3,22 +3,132 @@
 #include "timer.h"
 #include "memory.h"
 #include "interrupts.h"
+#include "scheduler.h"
 #include "log.h"
 
+// Cycles between two counter increments, indexed by the control clock select
+static const uint16_t timer_periods[4] = { 256, 4, 16, 64 };
+
+static inline uint8_t timer_divider(timer* t, uint64_t now) {
+	return (now - t->divider_reset) / TIMER_DIVIDER_PERIOD;
+}
+
+// Add increments to the counter, reloading the modulo on overflows
+static void timer_add(timer* t, uint64_t ticks) {
+	if (ticks <= 0xFF - t->reg.counter) {
+		t->reg.counter += ticks;
+		return;
+	}
+
+	ticks -= 0x100 - t->reg.counter;
+	t->reg.counter = t->reg.modulo + ticks % (0x100 - t->reg.modulo);
+}
+
+// Bring the counter up to date. It is incremented each time the divider
+// internal clock crosses a multiple of the period.
+static void timer_sync(timer* t, uint64_t now) {
+	if (t->reg.control & TIMER_ENABLE) {
+		uint16_t period = timer_periods[t->reg.control & 0x3];
+		timer_add(t, (now - t->divider_reset) / period - (t->counter_sync - t->divider_reset) / period);
+	}
+
+	t->counter_sync = now;
+}
+
+// Schedule the next counter overflow
+static void timer_schedule(timer* t) {
+	if ((t->reg.control & TIMER_ENABLE) == 0) {
+		scheduler_cancel(t->sch, t->ev);
+		return;
+	}
+
+	uint16_t period = timer_periods[t->reg.control & 0x3];
+	uint64_t ticks = (t->counter_sync - t->divider_reset) / period + (0x100 - t->reg.counter);
+	scheduler_schedule(t->sch, t->ev, t->divider_reset + ticks * period);
+}
+
+static uint8_t timer_read(void* dev, uint16_t addr) {
+	timer* t = dev;
+	uint64_t now = t->sch->now;
+
+	switch (addr) {
+	case 0xFF04:
+		DEBUG_MEMORY("Reading Timer Divider register = %X\n", timer_divider(t, now));
+		return timer_divider(t, now);
+	case 0xFF05:
+		timer_sync(t, now);
+		DEBUG_MEMORY("Reading Timer Counter register = %X\n", t->reg.counter);
+		return t->reg.counter;
+	case 0xFF06:
+		DEBUG_MEMORY("Reading Timer Modulo register = %X\n", t->reg.modulo);
+		return t->reg.modulo;
+	default:
+		DEBUG_MEMORY("Reading Timer Control register = %X\n", t->reg.control);
+		return t->reg.control;
+	}
+}
+
+static void timer_write(void* dev, uint16_t addr, uint8_t value) {
+	timer* t = dev;
+	uint64_t now = t->sch->now;
+
+	timer_sync(t, now);
+
+	switch (addr) {
+	case 0xFF04:
+		DEBUG_TIMER("Setting Timer Divider register to %X\n", 0);
+
+		// The counter sees a falling edge when the reset clears its clock bit
+		if (t->reg.control & TIMER_ENABLE) {
+			uint16_t period = timer_periods[t->reg.control & 0x3];
+			if ((now - t->divider_reset) % period >= period / 2) {
+				if (t->reg.counter == 0xFF)
+					interrupts_raise(t->ir, IRQ_TIMER);
+				timer_add(t, 1);
+			}
+		}
+
+		t->divider_reset = now;
+		break;
+	case 0xFF05:
+		DEBUG_TIMER("Setting Timer Counter register to %X\n", value);
+		t->reg.counter = value;
+		break;
+	case 0xFF06:
+		DEBUG_TIMER("Setting Timer Modulo register to %X\n", value);
+		t->reg.modulo = value;
+		break;
+	default:
+		DEBUG_TIMER("Setting Timer Control register to %X\n", value & 0x7);
+		t->reg.control = value & 0x7;
+		break;
+	}
+
+	timer_schedule(t);
+}
+
 timer* timer_init(memory *mem) {
 	timer *t = malloc(sizeof(timer));
 	if (t == NULL)
 		ERROR("Unable to allocate memory for timer.\n");
 
-	t->reg.tick_divider = 0;
-	t->reg.tick_counter = 0;
-
-	t->reg.divider = 0;
 	t->reg.counter = 0;
 	t->reg.modulo = 0;
 	t->reg.control = 0;
 
 	memory_set_timer(mem, t);
+
+	// Disabled at start, nothing scheduled
+	t->ir = mem->ir;
+	t->sch = mem->sch;
+	t->ev = scheduler_add_event(t->sch, timer_process, t);
+	t->divider_reset = t->sch->now;
+	t->counter_sync = t->sch->now;
+
+	uint16_t addr = 0;
+	for (addr = 0xFF04; addr <= 0xFF07; addr++)
+		memory_register_io(mem, addr, timer_read, timer_write, t);
+
 	return t;
 }
 
@@ -26,39 +136,11 @@ void timer_end(timer* t) {
 	free(t);
 }
 
-void timer_process(timer* t, interrupts *ir , uint16_t clk) {
-	if ((t->reg.control & 0x3) == 0)
-		return;
-	t->reg.tick_divider += clk;
-	t->reg.tick_counter += clk;
-
-	if (t->reg.tick_divider >= 64) {
-		t->reg.tick_divider -= 64;
-		t->reg.divider++;
-	}
-
-	uint16_t threshold = 0;
-	switch(t->reg.control & 0x3) {
-	case 0:
-		threshold = 64 * 4;
-		break;
-	case 1:
-		threshold = 1 * 4;
-		break;
-	case 2:
-		threshold = 4 * 4;
-		break;
-	case 3:
-		threshold = 16 * 4;
-		break;
-	}
+// Scheduler event at counter overflow
+void timer_process(void* dev, uint64_t now) {
+	timer* t = dev;
 
-	if (t->reg.tick_counter >= threshold) {
-		if (t->reg.counter == 0xFF) {
-			t->reg.counter = t->reg.modulo;
-			interrupts_raise(ir, IRQ_TIMER);
-		} else {
-			t->reg.counter++;
-		}
-	}
+	timer_sync(t, now);
+	interrupts_raise(t->ir, IRQ_TIMER);
+	timer_schedule(t);
 }
@@ -3,20 +3,31 @@
 
 #include <stdint.h>
 
+#define TIMER_ENABLE 0x4
+#define TIMER_DIVIDER_PERIOD 64 // Cycles between two divider increments
+
 typedef struct interrupts interrupts;
 typedef struct memory memory;
+typedef struct scheduler scheduler;
+typedef struct scheduler_event scheduler_event;
+
+// Registers are computed on access from the time of the last divider reset
+// and of the last counter update, only overflows are scheduled.
 typedef struct timer {
 	struct {
-		uint8_t divider;
 		uint8_t counter;
 		uint8_t modulo;
 		uint8_t control;
-		uint8_t tick_divider;
-		uint8_t tick_counter;
 	} reg;
+
+	interrupts *ir;
+	scheduler *sch;
+	scheduler_event *ev; // Next counter overflow
+	uint64_t divider_reset;
+	uint64_t counter_sync;
 } timer;
 
 timer *timer_init(memory *mem);
 void timer_end(timer* t);
-void timer_process(timer* t, interrupts *it, uint16_t clk);
+void timer_process(void* dev, uint64_t now);
 #endif     // __TIMER_H__